@@ -0,0 +1,218 @@
+/* Benchmarks Pricer against a fixed set of synthetic feeds, so that the effect of a change to the book or the      */
+/* parser can be measured the same way every time.                                                                 */
+/*                                                                                                                 */
+/*   ./Bench [-n messages] [-r runs] [-P pricer] [-G feedgen] [-a "pricer options"] [scenario ...]                 */
+/*                                                                                                                 */
+/* Each scenario is a FeedGen command line with a fixed seed, so the feeds are identical from one run of Bench to  */
+/* the next.  The feed is written to a temporary file first, and Pricer then reads it with -f, so generating it is  */
+/* not part of what gets timed.  Pricer's output is read back through a pipe and its lines counted.  For each      */
+/* scenario the fastest of the runs is reported, as messages per second, output lines per second, and Pricer's      */
+/* peak resident set size.  With no scenarios named, all of them are run.                                          */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+
+struct scenario_struct_type
+{
+char *name;
+char *feedgen_options;  // Everything but -n, which comes from Bench's own -n.
+char *targets;          // Target sizes passed to Pricer.
+char *description;
+} scenarios[] =
+  {
+    {"thin",         "-r 1 -l 200 -w 20 -d 70 -c 45",          "200",          "few live orders, tight spread"},
+    {"deep",         "-r 2 -l 200000 -w 2000 -d 20 -c 40",     "200",          "many live orders spread across many levels"},
+    {"cancel-storm", "-r 3 -l 50000 -w 200 -d 60 -c 49 -u 90", "200",          "mostly reduces at the inside, in bursts"},
+    {"one-sided",    "-r 4 -l 20000 -w 500 -d 50 -c 40 -B 95", "200",          "nearly all buy orders; sell side rarely prices"},
+    {"multi-target", "-r 5 -l 20000 -w 500 -d 50 -c 40",       "100 1000 10000", "several target sizes at once"},
+  };
+#define SCENARIO_COUNT (int)(sizeof(scenarios) / sizeof(scenarios[0]))
+
+long message_count=1000000;
+int  run_count=3;
+char *pricer_path="./Pricer", *feedgen_path="./FeedGen", *pricer_options="";
+
+
+int split_words(char *string,char *words[],int max_words)  // Splits a copy of an option string on spaces for execv().
+{
+int count=0;
+char *word;
+for (word = strtok(string," "); word && count < max_words; word = strtok(NULL," "))
+  words[count++] = word;
+return(count);
+}
+
+double seconds_now(void)
+{
+struct timespec now;
+clock_gettime(CLOCK_MONOTONIC,&now);
+return(now.tv_sec + now.tv_nsec / 1e9);
+}
+
+void generate_feed(struct scenario_struct_type *scenario,char *feed_path)
+{
+char options[256], count[32];
+char *argv[40];
+int argc=0, fd, status;
+pid_t pid;
+snprintf(options,sizeof(options),"%s",scenario->feedgen_options);
+snprintf(count,sizeof(count),"%ld",message_count);
+argv[argc++] = feedgen_path;
+argv[argc++] = "-n";
+argv[argc++] = count;
+argc += split_words(options,argv + argc,36);
+argv[argc] = NULL;
+if ((fd = open(feed_path,O_WRONLY | O_TRUNC)) < 0)
+  {
+  perror(feed_path);
+  exit(3);
+  }
+if ((pid = fork()) == 0)
+  {
+  dup2(fd,1);
+  execv(feedgen_path,argv);
+  perror(feedgen_path);
+  _exit(127);
+  }
+close(fd);
+if (pid < 0 || waitpid(pid,&status,0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+  {
+  fprintf(stderr,"Generating the %s feed failed.\n",scenario->name);
+  exit(4);
+  }
+}
+
+void run_pricer(struct scenario_struct_type *scenario,char *feed_path,double *seconds,long *lines,long *peak_rss_kb)
+{
+char options[256], targets[256], buffer[65536];
+char *argv[60];
+int argc=0, pipe_fds[2], status;
+ssize_t got, i;
+pid_t pid;
+struct rusage usage;
+double start;
+snprintf(options,sizeof(options),"%s",pricer_options);
+snprintf(targets,sizeof(targets),"%s",scenario->targets);
+argv[argc++] = pricer_path;
+argc += split_words(options,argv + argc,20);
+argv[argc++] = "-f";
+argv[argc++] = feed_path;
+argc += split_words(targets,argv + argc,20);
+argv[argc] = NULL;
+if (pipe(pipe_fds))
+  {
+  perror("pipe");
+  exit(5);
+  }
+start = seconds_now();
+if ((pid = fork()) == 0)
+  {
+  dup2(pipe_fds[1],1);
+  close(pipe_fds[0]);
+  close(pipe_fds[1]);
+  execv(pricer_path,argv);
+  perror(pricer_path);
+  _exit(127);
+  }
+close(pipe_fds[1]);
+*lines = 0;
+while ((got = read(pipe_fds[0],buffer,sizeof(buffer))) > 0)
+  for (i = 0; i < got; i++)
+    *lines += buffer[i] == '\n';
+close(pipe_fds[0]);
+if (pid < 0 || wait4(pid,&status,0,&usage) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+  {
+  fprintf(stderr,"Pricer failed on the %s feed.\n",scenario->name);
+  exit(6);
+  }
+*seconds     = seconds_now() - start;
+*peak_rss_kb = usage.ru_maxrss;  // Kilobytes, on Linux.
+}
+
+void run_scenario(struct scenario_struct_type *scenario)
+{
+char feed_path[] = "/tmp/Bench.XXXXXX";
+double seconds, best_seconds=0;
+long lines, peak_rss_kb, best_peak_rss_kb=0;
+int fd, run;
+if ((fd = mkstemp(feed_path)) < 0)
+  {
+  perror("mkstemp");
+  exit(3);
+  }
+close(fd);
+generate_feed(scenario,feed_path);
+for (run = 0; run < run_count; run++)
+  {
+  run_pricer(scenario,feed_path,&seconds,&lines,&peak_rss_kb);
+  if (run == 0 || seconds < best_seconds)
+    best_seconds = seconds;
+  if (peak_rss_kb > best_peak_rss_kb)
+    best_peak_rss_kb = peak_rss_kb;
+  }
+unlink(feed_path);
+printf("%-14s %10ld %9.3f %14.0f %14.0f %12ld   %s\n",scenario->name,message_count,best_seconds,
+       message_count / best_seconds,lines / best_seconds,best_peak_rss_kb,scenario->description);
+fflush(stdout);
+}
+
+
+int main(int argc,char *argv[])
+{
+int option, i, j;
+while ((option = getopt(argc,argv,"n:r:P:G:a:")) != -1)
+  switch (option)
+    {
+    case 'n': message_count  = strtol(optarg,(char **)NULL,10);  break;
+    case 'r': run_count      = atoi(optarg);                     break;
+    case 'P': pricer_path    = optarg;                           break;
+    case 'G': feedgen_path   = optarg;                           break;
+    case 'a': pricer_options = optarg;                           break;
+    default:
+      fputs("Invalid arguments; syntax:  ./Bench [-n messages] [-r runs] [-P pricer] [-G feedgen] [-a \"pricer options\"] [scenario ...]\n",stderr);
+      exit(1);
+    }
+if (message_count < 1 || run_count < 1)
+  {
+  fputs("Invalid arguments; message and run counts must be positive.\n",stderr);
+  exit(1);
+  }
+for (i = optind; i < argc; i++)  // Check the scenario names before spending any time on the ones that are valid.
+  {
+  for (j = 0; j < SCENARIO_COUNT; j++)
+    if (!strcmp(argv[i],scenarios[j].name))
+      break;
+  if (j == SCENARIO_COUNT)
+    {
+    fprintf(stderr,"Unknown scenario %s; the scenarios are:",argv[i]);
+    for (j = 0; j < SCENARIO_COUNT; j++)
+      fprintf(stderr," %s",scenarios[j].name);
+    fputs("\n",stderr);
+    exit(2);
+    }
+  }
+printf("%-14s %10s %9s %14s %14s %12s\n","scenario","messages","seconds","messages/sec","lines/sec","peak RSS KB");
+for (j = 0; j < SCENARIO_COUNT; j++)
+  {
+  if (optind < argc)
+    {
+    for (i = optind; i < argc; i++)
+      if (!strcmp(argv[i],scenarios[j].name))
+        break;
+    if (i == argc)
+      continue;
+    }
+  run_scenario(&scenarios[j]);
+  }
+exit(0);
+}
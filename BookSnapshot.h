@@ -0,0 +1,68 @@
+/* Shared-memory book snapshot written by Pricer -S and read by BookWatch, or by any other process on the same box.*/
+/*                                                                                                                 */
+/* Pricer keeps the snapshot in a file that it maps shared (put it under /dev/shm to keep it off the disk), and    */
+/* brings it up to date after every message: the best few levels of each side, the share count of each side, and   */
+/* the latest price of each target size, the same figures its output lines are made from.  A reader maps the same  */
+/* file read-only and takes copies with book_snapshot_read(), with no system calls and no text to parse.           */
+/*                                                                                                                 */
+/* The snapshot is kept twice over, under a sequence number whose low bit says which copy readers should take.     */
+/* Pricer bumps the number to send readers to the other copy before it changes one, so there is always a complete  */
+/* copy that nothing is writing, and a reader copies that one and keeps what it got if the number hasn't moved     */
+/* since.  Neither side ever waits for the other: Pricer never waits for readers, so a slow or stopped reader can't*/
+/* hold up the book, and a reader never waits out an update partway done.  A reader only tries again when it was so*/
+/* slow that Pricer went on to the copy it was reading, which takes two updates of well under a microsecond each.  */
+/* Only the side of the book a message touched is rewritten, in each copy in turn.                                 */
+
+#ifndef BOOK_SNAPSHOT_H
+#define BOOK_SNAPSHOT_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define BOOK_SNAPSHOT_MAGIC   0x4b4f4f42  // "BOOK", little-endian; set once the snapshot is ready to be read.
+#define BOOK_SNAPSHOT_VERSION 2
+#define BOOK_SNAPSHOT_LEVELS  10          // Price levels kept for each side, best first.
+#define BOOK_SNAPSHOT_TARGETS 16          // Same as the most target sizes Pricer can price at once.
+#define BOOK_SNAPSHOT_NO_PRICE -1         // Target price when the side doesn't hold that many shares; Pricer prints "NA".
+
+struct book_snapshot_level_struct_type
+{
+int64_t price;  // In cents.
+int64_t size;   // Shares.
+};
+
+struct book_snapshot_struct_type  // One copy of the book's figures, and what book_snapshot_read() hands back.
+{
+uint64_t message_count;                     // Messages applied to the book so far.
+char     timestamp[24];                     // Timestamp of the last of them, null-terminated.
+int64_t  bid_count, ask_count;              // Shares on each side of the book.
+int32_t  bid_level_count, ask_level_count;  // How many entries of bids[] and asks[] are in use.
+int32_t  target_count, reserved;
+int64_t  target_sizes[BOOK_SNAPSHOT_TARGETS];
+int64_t  buy_price[BOOK_SNAPSHOT_TARGETS];   // Cost in cents of buying each target size from the asks (Pricer's 'B' lines).
+int64_t  sell_price[BOOK_SNAPSHOT_TARGETS];  // Proceeds in cents of selling each target size into the bids (Pricer's 'S' lines).
+struct book_snapshot_level_struct_type bids[BOOK_SNAPSHOT_LEVELS], asks[BOOK_SNAPSHOT_LEVELS];
+};
+
+struct book_snapshot_file_struct_type  // The whole file.
+{
+uint32_t magic, version;                     // BOOK_SNAPSHOT_MAGIC and BOOK_SNAPSHOT_VERSION.
+uint64_t sequence;                           // Bumped before either copy changes; readers take copies[sequence & 1].
+struct book_snapshot_struct_type copies[2];
+};
+
+
+static inline void book_snapshot_read(const struct book_snapshot_file_struct_type *shared,struct book_snapshot_struct_type *copy)  // Takes the latest complete copy of the snapshot.
+{
+uint64_t before, after;
+do
+  {
+  before = __atomic_load_n(&shared->sequence,__ATOMIC_ACQUIRE);
+  memcpy(copy,(const void *)&shared->copies[before & 1],sizeof(*copy));  // Pricer is writing the other one, if either.
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);  // Keeps the copy from being read after the second look at the sequence number.
+  after = __atomic_load_n(&shared->sequence,__ATOMIC_RELAXED);
+  }
+while (before != after);  // Moved on?  Then Pricer may have started on this copy, and the other is complete now.
+}
+
+#endif
@@ -0,0 +1,95 @@
+/* Prints the book snapshot that Pricer publishes with -S (see BookSnapshot.h), as an example of reading it and as a  */
+/* way of looking in on a running Pricer.                                                                          */
+/*                                                                                                                 */
+/*   ./BookWatch [-i ms] [-n count] file                                                                           */
+/*                                                                                                                 */
+/* With no -i, the snapshot is printed once.  With -i, it is printed every ms milliseconds, count times, or until    */
+/* interrupted if there is no -n.  BookWatch only ever reads the file, and Pricer never waits on it.                */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "BookSnapshot.h"
+
+
+char *dollars(int64_t cents,char text[])  // Formats a price in cents the way Pricer prints it, or "NA".
+{
+if (cents == BOOK_SNAPSHOT_NO_PRICE)
+  strcpy(text,"NA");
+else
+  sprintf(text,"%lld.%02lld",(long long)(cents / 100),(long long)(cents % 100));
+return(text);
+}
+
+void print_snapshot(struct book_snapshot_struct_type *snapshot)
+{
+char buy[32], sell[32], bid[32], ask[32];
+int i;
+printf("%llu messages, last at %s; bids %lld shares, asks %lld shares\n",(unsigned long long)snapshot->message_count,
+       snapshot->timestamp[0] ? snapshot->timestamp : "-",(long long)snapshot->bid_count,(long long)snapshot->ask_count);
+for (i = 0; i < snapshot->target_count && i < BOOK_SNAPSHOT_TARGETS; i++)
+  printf("  target %lld: buy %s, sell %s\n",(long long)snapshot->target_sizes[i],dollars(snapshot->buy_price[i],buy),dollars(snapshot->sell_price[i],sell));
+for (i = 0; i < BOOK_SNAPSHOT_LEVELS && (i < snapshot->bid_level_count || i < snapshot->ask_level_count); i++)
+  {
+  if (i < snapshot->bid_level_count)
+    printf("  %10lld @ %-10s",(long long)snapshot->bids[i].size,dollars(snapshot->bids[i].price,bid));
+  else
+    printf("  %23s","");
+  if (i < snapshot->ask_level_count)
+    printf("   %10lld @ %s",(long long)snapshot->asks[i].size,dollars(snapshot->asks[i].price,ask));
+  printf("\n");
+  }
+fflush(stdout);
+}
+
+
+int main(int argc,char *argv[])
+{
+struct book_snapshot_file_struct_type *shared;
+struct book_snapshot_struct_type copy;
+struct timespec pause;
+long interval=0, count=0, n;
+int option, file_descriptor;
+while ((option = getopt(argc,argv,"i:n:")) != -1)
+  switch (option)
+    {
+    case 'i': interval = strtol(optarg,(char **)NULL,10);  break;
+    case 'n': count    = strtol(optarg,(char **)NULL,10);  break;
+    default:
+      fputs("Invalid arguments; syntax:  ./BookWatch [-i ms] [-n count] file\n",stderr);
+      exit(1);
+    }
+if (optind != argc - 1)
+  {
+  fputs("Invalid arguments; syntax:  ./BookWatch [-i ms] [-n count] file\n",stderr);
+  exit(1);
+  }
+if ((file_descriptor = open(argv[optind],O_RDONLY)) < 0 ||
+    (shared = mmap(0,sizeof(*shared),PROT_READ,MAP_SHARED,file_descriptor,0)) == MAP_FAILED)
+  {
+  perror(argv[optind]);
+  exit(2);
+  }
+if (__atomic_load_n(&shared->magic,__ATOMIC_ACQUIRE) != BOOK_SNAPSHOT_MAGIC || shared->version != BOOK_SNAPSHOT_VERSION)
+  {
+  fputs("Not a book snapshot, or not one this BookWatch understands.\n",stderr);
+  exit(3);
+  }
+if (!interval)
+  count = 1;
+pause.tv_sec  = interval / 1000;
+pause.tv_nsec = interval % 1000 * 1000000;
+for (n = 0; !count || n < count; n++)
+  {
+  if (n)
+    nanosleep(&pause,0);
+  book_snapshot_read(shared,&copy);
+  print_snapshot(&copy);
+  }
+exit(0);
+}
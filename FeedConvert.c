@@ -0,0 +1,143 @@
+/* Converts the order book feed between the text format that Pricer reads by default and the fixed-width binary     */
+/* records described in FeedFormat.h, which Pricer reads when given the -b option.                                 */
+/*                                                                                                                 */
+/*   ./FeedConvert -b < feed.txt > feed.bin     text to binary                                                     */
+/*   ./FeedConvert -t < feed.bin > feed.txt     binary to text                                                     */
+/*                                                                                                                 */
+/* Text lines are taken apart the same way Pricer takes them apart, and lines that Pricer would skip over are       */
+/* skipped here too, with the same complaints on stderr.  Lines with an operation type other than 'A' or 'R' have  */
+/* no binary representation; Pricer never does anything with them anyway, so they are dropped with a complaint.     */
+/* So are the rare lines with a negative price or size, or one too big for the record's 32 bits.                    */
+/* Going from binary back to text gives prices with exactly two decimal places and timestamps without leading      */
+/* zeros, which Pricer reads the same as the original text.                                                        */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "FeedFormat.h"
+
+
+char input_buffer[256];  // This is used to read the lines of a text feed.
+char *timestamp_pointer, *operation_type_pointer, *order_id_pointer, *side_pointer, *price_pointer, *size_pointer;
+struct feed_record_struct_type record;
+char order_id[FEED_ORDER_ID_MAX_LENGTH+1];
+long records_converted;
+long price, size;  // Checked against what a record can hold before they go into it.
+
+
+void text_to_binary(void)
+{
+while (fgets(input_buffer,sizeof(input_buffer),stdin))
+  {
+  memset(&record,0,sizeof(record));
+  if ((timestamp_pointer = strtok(input_buffer," \n")) == NULL)
+    {
+    fputs("No string found; continuing.\n",stderr);
+    continue;
+    }
+  if ((operation_type_pointer = strtok(NULL," \n")) == NULL)
+    {
+    fputs("No operation type field found; continuing.\n",stderr);
+    continue;
+    }
+  if ((order_id_pointer = strtok(NULL," \n")) == NULL)
+    {
+    fputs("No order id field found; continuing.\n",stderr);
+    continue;
+    }
+  record.timestamp = strtoull(timestamp_pointer,(char **)NULL,10);
+  record.operation = operation_type_pointer[0];
+  record.order_id  = feed_order_id_to_key(order_id_pointer,strlen(order_id_pointer),&record.order_id_extra);
+  if (record.operation == 'A')
+    {
+    if ((side_pointer = strtok(NULL," \n")) == NULL)
+      {
+      fputs("No side field found; continuing.\n",stderr);
+      continue;
+      }
+    if ((price_pointer = strtok(NULL," \n")) == NULL)
+      {
+      fputs("No price field found; continuing.\n",stderr);
+      continue;
+      }
+    if ((size_pointer = strtok(NULL," \n")) == NULL)
+      {
+      fputs("No size field found; continuing.\n",stderr);
+      continue;
+      }
+    price = strtol(price_pointer,(char **)NULL,10) * 100;  // Same conversion as Pricer: dollars, then two digits of cents if there is a period.
+    if (strchr(price_pointer,'.'))
+      price += strtol(strchr(price_pointer,'.')+1,(char **)NULL,10);
+    size  = strtol(size_pointer,(char **)NULL,10);
+    if (price < 0 || price > 0xffffffffL || size < 0 || size > 0xffffffffL)
+      {
+      fputs("Price or size won't fit in a binary record; continuing.\n",stderr);
+      continue;
+      }
+    record.side  = side_pointer[0];
+    record.price = price;
+    record.size  = size;
+    }
+  else
+  if (record.operation == 'R')
+    {
+    if ((size_pointer = strtok(NULL," \n")) == NULL)
+      {
+      fputs("No size field found; continuing.\n",stderr);
+      continue;
+      }
+    if ((size = strtol(size_pointer,(char **)NULL,10)) < 0 || size > 0xffffffffL)
+      {
+      fputs("Price or size won't fit in a binary record; continuing.\n",stderr);
+      continue;
+      }
+    record.size = size;
+    }
+  else
+    {
+    fputs("Unknown operation type; skipping.\n",stderr);
+    continue;
+    }
+  if (fwrite(&record,sizeof(record),1,stdout) != 1)
+    {
+    fputs("Error writing output.\n",stderr);
+    exit(3);
+    }
+  records_converted++;
+  }
+}
+
+void binary_to_text(void)
+{
+while (fread(&record,sizeof(record),1,stdin) == 1)
+  {
+  feed_key_to_order_id(record.order_id,record.order_id_extra,order_id);
+  if (record.operation == 'A')
+    printf("%llu A %s %c %u.%02u %u\n",(unsigned long long)record.timestamp,order_id,record.side,record.price / 100,record.price % 100,record.size);
+  else
+    printf("%llu %c %s %u\n",(unsigned long long)record.timestamp,record.operation,order_id,record.size);
+  records_converted++;
+  }
+}
+
+
+int main(int argc,char *argv[])
+{
+if (argc != 2 || (strcmp(argv[1],"-b") && strcmp(argv[1],"-t")))
+  {
+  fputs("Invalid arguments; syntax:  ./FeedConvert -b < text > binary    or    ./FeedConvert -t < binary > text\n",stderr);
+  exit(1);
+  }
+if (argv[1][1] == 'b')
+  text_to_binary();
+else
+  binary_to_text();
+if (fflush(stdout))
+  {
+  fputs("Error writing output.\n",stderr);
+  exit(3);
+  }
+fprintf(stderr,"%ld records converted.\n",records_converted);
+exit(0);
+}
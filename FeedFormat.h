@@ -0,0 +1,110 @@
+/* Binary feed format shared by Pricer and FeedConvert.                                                            */
+/*                                                                                                                 */
+/* Parsing the text feed costs far more than updating the book does, so for jobs that replay the same day over and */
+/* over, the feed can be converted once into fixed-width binary records and replayed from those with no parsing at */
+/* all (see the -b option of Pricer, and FeedConvert for getting to and from the text format).  Each record is 32   */
+/* bytes, little-endian, with no file header, so a record's byte offset is always 32 times its sequence number.    */
+/*                                                                                                                 */
+/* The timestamp is kept as an integer, so any leading zeros it had in the text feed are lost.  The order ID is     */
+/* packed into an integer the same way Pricer's order table packs it (see feed_order_id_to_key()), along with an   */
+/* extra word for the rare ID that doesn't fit in the integer.  Prices are in cents, as everywhere else in Pricer.  */
+
+#ifndef FEED_FORMAT_H
+#define FEED_FORMAT_H
+
+#include <stdint.h>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "The binary feed records are read and written in host byte order, which must be little-endian."
+#endif
+
+#define FEED_ORDER_ID_MAX_LENGTH  10                     // Characters of an order ID that count; any after those are ignored, as they always were.
+#define FEED_ORDER_ID_BYTE_LENGTH 8                      // Order IDs up to this long are packed a character per byte,
+#define FEED_KEY_SIX_BIT          0x8000000000000000ULL  // and longer ones six bits per character, with this bit set.
+#define FEED_KEY_SPARE_BITS       0x0080808000000000ULL  // Clear in the key of any order ID of ASCII characters.
+#define FEED_SIX_BIT_CHARACTERS   "?0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz-"  // By code; 0 is padding.
+
+struct feed_record_struct_type
+{
+uint64_t timestamp;       // Milliseconds since midnight, as in the text feed.
+uint64_t order_id;        // Packed order ID (see feed_order_id_to_key()).
+uint32_t price;           // In cents; zero for 'R'educe records.
+uint32_t size;            // Shares added, or shares to reduce by.
+uint8_t  operation;       // 'A'dd or 'R'educe
+uint8_t  side;            // 'B'uy or 'S'ell; zero for 'R'educe records.
+uint16_t order_id_extra;  // The part of an order ID that doesn't fit in order_id; zero for nearly all of them.
+uint8_t  reserved[4];     // Zero; pads the record out to 32 bytes.
+};
+
+typedef char feed_record_size_check[sizeof(struct feed_record_struct_type) == 32 ? 1 : -1];  // Fails to compile if the compiler pads the record differently.
+
+
+// Only the first 10 characters of an order ID count.  An ID of up to 8 characters is packed one character per byte, so one of
+// ASCII characters leaves the high bit of every byte clear.  A 9- or 10-character ID is packed instead as ten six-bit codes (a
+// leading 0 for a 9-character ID, then each character's place in FEED_SIX_BIT_CHARACTERS) with FEED_KEY_SIX_BIT set.  The 60
+// bits of codes are laid out around FEED_KEY_SPARE_BITS, which stay clear either way for a user of the keys to keep something
+// of its own in (Pricer's venue mode does).  Those two ways take every ID seen in practice; any other (one with a character
+// that has no six-bit code, or an 8-character one whose first character would set the top bit) has its first two characters
+// put in the extra word, which is otherwise zero, and the rest packed a character per byte.  Order IDs never contain a null
+// character, so the extra word of such an ID is never zero, and every key and extra word unpack to the very ID they came from.
+
+static inline int feed_six_bit_code(unsigned char c)  // A character's six-bit code, or 0 if it hasn't got one.
+{
+if (c >= '0' && c <= '9')
+  return(c - '0' + 1);
+if (c >= 'A' && c <= 'Z')
+  return(c - 'A' + 11);
+if (c >= 'a' && c <= 'z')
+  return(c - 'a' + 37);
+return(c == '-' ? 63 : 0);
+}
+
+static inline uint64_t feed_order_id_to_key(const char order_id[],int length,uint16_t *extra)  // Packs an order ID into an integer key, and into *extra what doesn't fit there.
+{
+uint64_t key=0;
+int i, code=0;
+*extra = 0;
+if (length > FEED_ORDER_ID_MAX_LENGTH)
+  length = FEED_ORDER_ID_MAX_LENGTH;
+if (length < FEED_ORDER_ID_BYTE_LENGTH || (length == FEED_ORDER_ID_BYTE_LENGTH && (unsigned char)order_id[0] < 0x80))
+  {
+  for (i = 0; i < length; i++)
+    key = (key << 8) | (unsigned char)order_id[i];
+  return(key);
+  }
+if (length > FEED_ORDER_ID_BYTE_LENGTH)
+  {
+  for (i = 0; i < length && (code = feed_six_bit_code(order_id[i])); i++)
+    key = (key << 6) | code;
+  if (i == length)
+    return(FEED_KEY_SIX_BIT | (key & 0x7fffffffffULL) | (key >> 39 & 0x7f) << 40 | (key >> 46 & 0x7f) << 48 | (key >> 53 & 0x7f) << 56);
+  key = 0;
+  }
+*extra = (uint16_t)((unsigned char)order_id[0] << 8 | (unsigned char)order_id[1]);
+for (i = 2; i < length; i++)
+  key = (key << 8) | (unsigned char)order_id[i];
+return(key);
+}
+
+static inline int feed_key_to_order_id(uint64_t key,uint16_t extra,char order_id[FEED_ORDER_ID_MAX_LENGTH+1])  // Unpacks a key and extra word back into a null-terminated order ID; returns its length.
+{
+int length=0, count=0, i;
+char reversed[FEED_ORDER_ID_BYTE_LENGTH];
+if (extra)
+  {
+  order_id[length++] = (char)(extra >> 8);
+  order_id[length++] = (char)(extra & 0xff);
+  }
+if (!extra && (key & FEED_KEY_SIX_BIT))
+  for (key = (key & 0x7fffffffffULL) | (key >> 40 & 0x7f) << 39 | (key >> 48 & 0x7f) << 46 | (key >> 56 & 0x7f) << 53; key; key >>= 6)
+    reversed[count++] = FEED_SIX_BIT_CHARACTERS[key & 0x3f];
+else
+  for (; key; key >>= 8)
+    reversed[count++] = (char)(key & 0xff);
+for (i = 0; i < count; i++)
+  order_id[length++] = reversed[count - 1 - i];
+order_id[length] = 0;
+return(length);
+}
+
+#endif
@@ -0,0 +1,168 @@
+/* Generates a synthetic order book feed for testing and benchmarking Pricer.                                      */
+/*                                                                                                                 */
+/* The feed is completely determined by the seed and the other settings, so a given command line always produces  */
+/* the same feed, byte for byte, on any machine; that makes it suitable for tracking Pricer's speed from one change */
+/* to the next.  The settings, all integers (percentages where noted), are:                                         */
+/*                                                                                                                 */
+/*   -n count    number of messages to generate                                          (default 1000000)         */
+/*   -r seed     random number seed                                                      (default 1)               */
+/*   -l count    number of live orders the book is held at, once it has built up           (default 10000)         */
+/*   -w ticks    how far from the inside, in cents, orders can be placed                   (default 500)           */
+/*   -d percent  share of adds placed within five cents of the inside, where the target     (default 50)            */
+/*               size is filled from                                                                               */
+/*   -c percent  share of messages that are reduces while the book is building up          (default 40)            */
+/*   -u percent  chance that a message carries the same timestamp as the one before it    (default 30)            */
+/*   -B percent  share of adds that are 'B'uy orders                                        (default 50)            */
+/*   -p cents    starting price of the inside market                                       (default 4400)          */
+/*   -b          write binary records (see FeedFormat.h) instead of text                                           */
+/*                                                                                                                 */
+/* The inside market takes a small random walk as the feed goes along.  Order IDs are lowercase letters counting up */
+/* from "a", so they always fit in Pricer's order table key.  Once the book holds the requested number of live     */
+/* orders, adds and reduces alternate so as to keep it there.                                                      */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "FeedFormat.h"
+
+
+long message_total=1000000, live_target=10000, spread_ticks=500, top_percent=50, cancel_percent=40, burst_percent=30, buy_percent=50;
+long inside_price=4400;
+int  binary_output;
+unsigned long long random_state=1;
+
+struct live_order_struct_type  // Just enough about each live order to generate reduces for it.
+{
+unsigned long long order_id;
+long size;
+} *live_orders;
+long live_count;
+
+unsigned long long next_order_number;
+unsigned long long timestamp=34200000;  // 9:30 am, in milliseconds since midnight.
+struct feed_record_struct_type record;
+char order_id[FEED_ORDER_ID_MAX_LENGTH+1];
+
+
+unsigned long long next_random(void)  // xorshift64*; small, fast, and the same everywhere.
+{
+random_state ^= random_state >> 12;
+random_state ^= random_state << 25;
+random_state ^= random_state >> 27;
+return(random_state * 0x2545f4914f6cdd1dULL);
+}
+
+long random_below(long limit)  // 0 through limit-1.
+{
+return((long)((next_random() >> 11) % (unsigned long long)limit));
+}
+
+unsigned long long new_order_id(void)  // "a", "b", ... "z", "ba", "bb", ... packed the way Pricer packs them.
+{
+char digits[FEED_ORDER_ID_MAX_LENGTH];
+unsigned long long n = next_order_number++;
+int length=0, i;
+uint16_t extra;  // Always 0 for IDs like these.
+do
+  digits[length++] = 'a' + n % 26;
+while ((n /= 26));
+for (i = 0; i < length; i++)
+  order_id[i] = digits[length - 1 - i];
+return(feed_order_id_to_key(order_id,length,&extra));
+}
+
+void emit_record(void)
+{
+if (binary_output)
+  fwrite(&record,sizeof(record),1,stdout);
+else
+  {
+  feed_key_to_order_id(record.order_id,record.order_id_extra,order_id);
+  if (record.operation == 'A')
+    printf("%llu A %s %c %u.%02u %u\n",(unsigned long long)record.timestamp,order_id,record.side,record.price / 100,record.price % 100,record.size);
+  else
+    printf("%llu R %s %u\n",(unsigned long long)record.timestamp,order_id,record.size);
+  }
+}
+
+void generate_add(void)
+{
+long offset;
+record.operation = 'A';
+record.order_id  = new_order_id();
+record.side      = random_below(100) < buy_percent ? 'B' : 'S';
+if (random_below(100) < top_percent)
+  offset = random_below(5);
+else  // The product of two uniform draws piles up toward the inside, the way real books do.
+  offset = random_below(spread_ticks) * random_below(spread_ticks) / spread_ticks;
+record.price = record.side == 'B' ? inside_price - 1 - offset : inside_price + 1 + offset;
+if ((long)record.price < 1)
+  record.price = 1;
+record.size  = random_below(4) ? 100 * (1 + random_below(5)) : 1 + random_below(999);  // Mostly round lots.
+live_orders[live_count].order_id = record.order_id;
+live_orders[live_count].size     = record.size;
+live_count++;
+}
+
+void generate_reduce(void)
+{
+long i = random_below(live_count);
+record.operation = 'R';
+record.order_id  = live_orders[i].order_id;
+record.side      = 0;
+record.price     = 0;
+record.size      = random_below(10) < 7 ? live_orders[i].size : 1 + random_below(live_orders[i].size);  // Mostly outright cancels.
+if ((live_orders[i].size -= record.size) == 0)
+  live_orders[i] = live_orders[--live_count];  // Swap the last live order into the hole.
+}
+
+
+int main(int argc,char *argv[])
+{
+int option;
+long n;
+while ((option = getopt(argc,argv,"n:r:l:w:d:c:u:B:p:b")) != -1)
+  switch (option)
+    {
+    case 'n': message_total  = strtol(optarg,(char **)NULL,10);             break;
+    case 'r': random_state   = strtoull(optarg,(char **)NULL,10) * 2 + 1;   break;  // Never zero, which xorshift can't get out of.
+    case 'l': live_target    = strtol(optarg,(char **)NULL,10);             break;
+    case 'w': spread_ticks   = strtol(optarg,(char **)NULL,10);             break;
+    case 'd': top_percent    = strtol(optarg,(char **)NULL,10);             break;
+    case 'c': cancel_percent = strtol(optarg,(char **)NULL,10);             break;
+    case 'u': burst_percent  = strtol(optarg,(char **)NULL,10);             break;
+    case 'B': buy_percent    = strtol(optarg,(char **)NULL,10);             break;
+    case 'p': inside_price   = strtol(optarg,(char **)NULL,10);             break;
+    case 'b': binary_output  = 1;                                           break;
+    default:
+      fputs("Invalid arguments; syntax:  ./FeedGen [-n count] [-r seed] [-l live] [-w ticks] [-d percent] [-c percent] [-u percent] [-B percent] [-p cents] [-b]\n",stderr);
+      exit(1);
+    }
+if (live_target < 1 || spread_ticks < 1 || inside_price < 2)
+  {
+  fputs("Invalid arguments; live order count, spread, and price must be positive.\n",stderr);
+  exit(1);
+  }
+if ((live_orders = malloc((live_target + 1) * sizeof(struct live_order_struct_type))) == 0)
+  {
+  fputs("insufficient memory for live order list\n",stderr);
+  exit(10);
+  }
+for (n = 0; n < message_total; n++)
+  {
+  if (random_below(100) >= burst_percent)
+    timestamp += 1 + random_below(10);
+  if (!random_below(50))  // Now and then the inside moves a tick.
+    inside_price += random_below(2) ? 1 : (inside_price > 2 ? -1 : 1);
+  memset(&record,0,sizeof(record));
+  record.timestamp = timestamp;
+  if (live_count && (live_count >= live_target || random_below(100) < cancel_percent))
+    generate_reduce();
+  else
+    generate_add();
+  emit_record();
+  }
+exit(0);
+}
@@ -12,17 +12,22 @@
 /* this point in the life of the program.  Suffice it to say that more diligence could certainly be applied in     */
 /* the area of error checking if it were warranted/required.                                                       */
 /*                                                                                                                 */
-/* In general, the program is going to read each input line, set pointers to the data fields (and terminate them)  */
-/* in the input buffer, and work with skip-lists, which are not susceptible to the unbalanced-tree problems like   */
-/* sequential adds and rebalancing that (balanced) binary trees are, and which this input data would cause.        */
+/* In general, the program is going to read each input line, set pointers to the data fields (along with their     */
+/* lengths, since the input is scanned in place and never written to), and work with skip-lists, which are not     */
+/* susceptible to the unbalanced-tree problems like sequential adds and rebalancing that (balanced) binary trees   */
+/* are, and which this input data would cause.                                                                     */
 /* Totals will be kept alongside the lists; although this is duplicate data, speed considerations probably warrant */
 /* this, and the DEBUG flag can be set to check the program's operation in regard to this duplicate data.          */
 /*                                                                                                                 */
-/* Three lists are kept: One by order ID, which is mainly used to look up the side of orders being reduced or      */
-/* removed, one by price ascending, holds 'S'ell orders, and one by price descending, which holds 'B'uy orders.    */
-/* Note that there is only one entry in each of the price lists for a given price, instead of an entry             */
+/* Two price ladders and a table are kept: A hash table by order ID, which is mainly used to look up the side and  */
+/* price of orders being reduced or removed, one ladder for 'S'ell orders, which is walked from the lowest price   */
+/* up, and one ladder for 'B'uy orders, which is walked from the highest price down.  These started out as three   */
+/* skip-lists; the order table is now an open-addressing hash table keyed by the order ID packed into a 64-bit     */
+/* integer, and each ladder is an array of price levels indexed by price, with the original skip-list kept only    */
+/* for prices that fall outside the ladder's window.  See the notes on those sections below.                       */
+/* Note that there is only one entry in each of the price ladders for a given price, instead of an entry           */
 /* corresponding to each order_id, since there is really no reason to maintain anything more than the price and    */
-/* share quantity as an aggregate.  This also makes these lists fairly small, at only one entry per price.         */
+/* share quantity as an aggregate.  This also makes the ladders fairly small, at only one entry per price.         */
 /*                                                                                                                 */
 /* In the interest of avoiding rounding errors, the program is entirely devoid of float functions and fields.      */
 /* This leads to some fairly mechanical-looking manipulations of strings and long integers, but it works well.     */
@@ -37,55 +42,121 @@
 /* to run under 32 bit compilers.  I suppose that could be made automatic.                                         */
 
 
+#define _GNU_SOURCE  // For pthread_setaffinity_np() and the CPU_ macros.
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "FeedFormat.h"
+#include "BookSnapshot.h"
 
 
 /*---------- Program-specific variable definitions ----------*/
 
 // General program variables
 #define DEBUG 0       // Set this to non-zero to institute various debug outputs and program consistency checks.  Search for "DEBUG" to find them.
-#define KEYLENGTH 10  // I added the key to the skip-list routines, and we'd like the length to be settable in the program somewhere.  Please note
-                      // that the code which reverses the key (by subtracting price from 9999999999) still doesn't use this constant yet.
+#ifndef INSTRUMENT
+#define INSTRUMENT 0  // Build with -DINSTRUMENT=1 for per-stage timing histograms; see "Instrumentation subroutines".
+#endif
 
-char input_buffer[100];  // This is used to read the lines from stdin.
-long target_size;        // This holds the value of the parameter passed on the command line.
+#define MAX_TARGETS 16  // Most target sizes that can be priced in one run.
+#define USAGE "Invalid arguments; syntax:  ./Pricer [-A N] [-b] [-B list [-j N] [-o dir]] [-c file [-i N]] [-C ms] [-f file] [-F size:N|time:MS|end] [-H] [-L address] [-m N] [-P] [-r file] [-R file [-t ms] [-w ms,...]] [-s] [-S file] [-V [name=]feed ... [-e]] [-W] ### [### ...]          where ### is target size to use (up to 16 of them)\n"
 
-// These pointers are using for parsing the input line in place.
-char *timestamp_pointer;       // Field one of each input line.
-char *operation_type_pointer;  // 'A'dd or 'R'educe order amount
-char *order_id_pointer;        // Unique order identifier; currently used only by 'R'educe order commands.
-char *side_pointer;            // This is a 'B'uy or 'S'ell order.
-char *price_pointer;           // This is the limit price of this order.
-char *size_pointer;            // When adding orders, this is the share count.  When reducing an order amount, this is the amount to reduce by.
+int  option;                       // Used for going through the command line options.
+char *input_file_name;             // Input file given with -f, or NULL to read stdin.
+int  binary_input;                 // Set by -b; the input is binary feed records instead of text.
+int  statistics_wanted;            // Set by -s.
+int  writer_thread_wanted;         // Set by -W.
+int  worker_count;                 // Set by -m; non-zero for multi-symbol mode.
+int  pipeline_wanted;              // Set by -P.
+long coalesce_interval=-1;         // Set by -C; -1 if every message is priced as it comes.
+long message_count;                // Number of input lines processed, for the statistics report.
+struct timespec start_time, end_time;  // For timing the run, likewise.
+struct rusage resource_usage;      // For the peak RSS in the memory report.
+
+long target_sizes[MAX_TARGETS];    // All of the target sizes passed on the command line.
+int  target_count;                 // How many of them there are.
+
+// These pointers are using for parsing the input line in place.  The fields aren't terminated, so each one comes with a length.
+// Like the rest of the input scanning state, they belong to the thread doing the parsing, since with -V each feed is parsed on
+// a thread of its own (see "Venue subroutines").
+__thread char *line_pointer, *line_end;  // The input line being worked on, and the newline at the end of it.
+__thread char *field_cursor;             // Where scanning for the next field in the line picks up.
+__thread char *timestamp_pointer;        // Field one of each input line.
+__thread char *symbol_pointer;           // Field two, in multi-symbol mode only.
+__thread char *operation_type_pointer;   // 'A'dd or 'R'educe order amount
+__thread char *order_id_pointer;         // Unique order identifier; currently used only by 'R'educe order commands.
+__thread char *side_pointer;             // This is a 'B'uy or 'S'ell order.
+__thread char *price_pointer;            // This is the limit price of this order.
+__thread char *size_pointer;             // When adding orders, this is the share count.  When reducing an order amount, this is the amount to reduce by.
+__thread int  timestamp_length, symbol_length, operation_type_length, order_id_length, side_length, price_length, size_length;
+
+// The message being worked on, as decoded from a text line or a binary record.  In multi-symbol and pipelined modes copies of it
+// are handed off to other threads, so it carries everything that applying it to a book takes.
+typedef struct {
+    char               operation_type;      // 'A'dd or 'R'educe order amount
+    char               side;                // 'B'uy or 'S'ell ('A'dd messages only)
+    unsigned short     order_key_extra;     // The part of the order ID that doesn't fit in order_key; nearly always 0.
+    long               price;               // In cents ('A'dd messages only)
+    long               size;                // Shares to add, or to reduce by
+    unsigned long long order_key;           // The order ID, packed into the order table's integer key.
+    char               *timestamp;          // Text of the timestamp (not terminated), once timestamp_length is set; see ready_timestamp().
+    int                timestamp_length;    // Zero until then, for a binary record, whose timestamp is only turned into text if it's printed.
+    unsigned long long timestamp_value;     // The timestamp of a binary record.
+    char               timestamp_text[24];  // Where that text is made, or where it's copied to when the message is handed off.
+} Message;
+__thread Message message;
 
 // Miscellaneous variables which are used locally here and there.
 char temp_string[100];
 int  temp_counter;
 long temp_long;                // For use in DEBUG statements and the like.
-char key_string[KEYLENGTH+1];  // Used for building and passing the key to the skip-list routines.  The extra byte is for a terminating null.
-long returned_price;           // Used for receiving the value returned by the routine which traverses nodes to place/fill an order.
-char dollar_string[16];        // Used for returning the value of the subroutine print_cents_as_dollars(), instead of passing a pointer back.
 
-// List entry fields
+// A price level, and the orders queued at it in arrival order.  These are laid out compactly, since there can be millions of
+// them; orders refer to one another by record number (see "Order-ID hash table").
+typedef unsigned int OrderIndex;  // Number of an order record; 0 means none.
+typedef struct {
+    long       size;                     // Number of shares
+    unsigned   order_count;              // Orders in the queue.
+    OrderIndex first_order, last_order;  // The queue, oldest first.
+} Level;
+typedef struct {
+    unsigned long long key;              // Packed order ID.
+    Level              *level;           // The price level the order is queued at.
+    OrderIndex         next, previous;   // Its neighbours in the level's queue.
+    unsigned int       price;            // In cents
+    unsigned int       size;             // Number of shares
+    char               side;             // 'B'uy or 'S'ell
+    unsigned short     key_extra;        // The part of the order ID that doesn't fit in key; nearly always 0.
+    unsigned int       wide;             // With a price or size that doesn't fit above, the number of the WideOrder that has them; else 0.
+} Order;
+typedef struct {
+    long price, size;                    // Or, while the entry is free, the number of the next free one in price.
+} WideOrder;
+
+// List entry fields; the price is the entry's key.
 struct list_entry_struct_type
 {
-char timestamp[10];
-char order_id[6];
-char side[1];
-long price;  // In cents
-long size;   // Number of shares
-}  list_entry;  // Define this variable so we can work on this data.
-
-long current_ask_count=0, previous_ask_count=0;  // We will track these figures here in spite of the fact that some of this is duplicate data,
-long current_bid_count=0, previous_bid_count=0;  // because tallying up the figures from the lists after every operation would be, well, slow.
-long previous_bid_price=0,previous_ask_price=0;  // These two variables are used only for deciding whether the price has changed and we should print something.
-
-// Create some working variables for passing values on from the input-processing code to the output-determining code.
-char side[1];
-long price;  // In cents
-long size;   // Number of shares
+char  side[1];
+Level level;
+};
 
 
 /*---------- Skip-list data structure data and subroutines ----------*/
@@ -93,25 +164,134 @@ long size;   // Number of shares
 // Skip-list variable definitions (see note below about origin of these skip-list routines)
 
 /* define data-type and compare operators here */
+// The keys used to be ten-character strings compared with strncmp(), with bid prices subtracted from 9999999999 so that the
+// list would still ascend from the best bid; they are now the prices themselves, compared as integers, and a list can be kept
+// in descending order instead.
 #define MAXLEVEL 15   // Maximum number of levels in the skip-list.  A few test runs seem to indicate that this number is good.
-#define compLT(a,b) (strncmp(a,b,KEYLENGTH) <  0)
-#define compEQ(a,b) (strncmp(a,b,KEYLENGTH) == 0)
+#define compLT(list,a,b) ((list)->descending ? (a) > (b) : (a) < (b))  /* does a come before b in the list? */
+#define compEQ(a,b)      ((a) == (b))
 typedef struct Node_ {
-    char                          key[KEYLENGTH];  /* 10 character key          */
+    long                          key;             /* price, in cents           */
     struct list_entry_struct_type data;            /* user's data               */
     struct Node_                  *forward[1];     /* skip-list forward pointer */
 } Node;
 typedef struct {
     Node *hdr;                  /* list Header */
     int listLevel;              /* current level of list */
+    int descending;             /* non-zero if the keys run from high to low */
+    struct NodePool_ *pool;     /* where its nodes come from */
 } SkipList;
-SkipList list_by_order_id,list_by_price_ascending,list_by_price_descending;  /* skip-list information */
 Node *list_pointer;  // This is for working with list entries as we add them, look them up, and the like.
 
 
+// Book node pool.  Rather than calling malloc() for every node inserted and free() for every node deleted, which under heavy
+// add/cancel churn costs a good deal of allocator time and scatters the nodes all over the heap, nodes are carved out of large
+// chunks of memory obtained with mmap(), optionally backed by huge pages (-H).  Since a node's size depends on its height (the
+// number of forward pointers it carries), freed nodes go on a separate free list per height, and are handed out again before any
+// fresh memory is used.  The chunks are never returned piecemeal; they are all released together at the end of the run.
+
+#define NODE_POOL_CHUNK_SIZE (2L << 20)  // 2 MB, which is also the size of a huge page on x86-64.
+
+typedef struct NodePool_ {
+    char *chunk_list;               // Most recently allocated chunk; the first word of each chunk points to the one before it.
+    char *chunk_next, *chunk_end;   // The part of the current chunk not yet handed out.
+    Node *free_list[MAXLEVEL+1];    // Freed nodes of each height, linked through forward[0].
+    Order **order_blocks;           // Order records, ORDER_BLOCK_SIZE to a block (see "Order-ID hash table").
+    long order_block_count;
+    OrderIndex order_next;          // Next record never handed out.
+    OrderIndex free_orders;         // Freed records, linked through their next fields.
+    WideOrder *wide_orders;         // Prices and sizes of the orders too big for their records; entry 0 is never handed out.
+    unsigned int wide_next, wide_room, free_wide;  // Next entry never handed out, entries there is room for, and the freed ones.
+    long order_live_count;          // Order records in use,
+    long order_peak_count;          // and the most ever in use at once.
+    int  huge_pages;                // Non-zero to ask for huge pages when allocating chunks.
+    long chunk_count;               // Chunks allocated.
+    long live_count;                // Nodes currently in use.
+    long peak_count;                // Most nodes ever in use at once.
+} NodePool;
+NodePool node_pool;  // The pool for the book, when there is only one; each worker thread has its own in multi-symbol mode.
+
+
+char *allocate_pool_chunk(NodePool *pool)  // Gets another chunk of memory from the system for the pool.
+{
+char *chunk = MAP_FAILED;
+#ifdef MAP_HUGETLB
+if (pool->huge_pages)  // This needs huge pages reserved ahead of time (vm.nr_hugepages); if there aren't any, fall back to a normal mapping.
+  chunk = mmap(0,NODE_POOL_CHUNK_SIZE,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+#endif
+if (chunk == MAP_FAILED && (chunk = mmap(0,NODE_POOL_CHUNK_SIZE,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0)) == MAP_FAILED)
+  {
+  fputs("insufficient memory allocating node pool chunk\n",stderr);
+  exit(15);
+  }
+#ifdef MADV_HUGEPAGE
+if (pool->huge_pages)  // Transparent huge pages are the next best thing, if the mapping above had to fall back.
+  madvise(chunk,NODE_POOL_CHUNK_SIZE,MADV_HUGEPAGE);
+#endif
+*(char **)chunk   = pool->chunk_list;
+pool->chunk_list  = chunk;
+pool->chunk_next  = chunk + 16;
+pool->chunk_end   = chunk + NODE_POOL_CHUNK_SIZE;
+pool->chunk_count++;
+return(chunk);
+}
+
+void *carve_from_pool(NodePool *pool,long size)  // Hands out fresh memory from the current chunk, rounded up to 16 bytes.
+{
+char *memory;
+size = (size + 15) & ~15L;
+if (pool->chunk_end - pool->chunk_next < size)
+  allocate_pool_chunk(pool);
+memory = pool->chunk_next;
+pool->chunk_next += size;
+return(memory);
+}
+
+Node *allocate_node(NodePool *pool,int level)  // Hands out a node with room for level+1 forward pointers.
+{
+Node *node;
+//
+if ((node = pool->free_list[level]))  // Reuse a freed node of the same height if there is one.
+  pool->free_list[level] = node->forward[0];
+else
+  node = carve_from_pool(pool,sizeof(Node) + level*sizeof(Node *));
+if (++pool->live_count > pool->peak_count)
+  pool->peak_count = pool->live_count;
+return(node);
+}
+
+void free_node(NodePool *pool,Node *node,int level)  // Puts a node back on the free list for its height.
+{
+node->forward[0] = pool->free_list[level];
+pool->free_list[level] = node;
+pool->live_count--;
+}
+
+void release_node_pool(NodePool *pool)  // Hands every chunk back to the system at once; any nodes still in use go with them.
+{
+char *chunk;
+while ((chunk = pool->chunk_list))
+  {
+  pool->chunk_list = *(char **)chunk;
+  munmap(chunk,NODE_POOL_CHUNK_SIZE);
+  }
+memset(pool->free_list,0,sizeof(pool->free_list));
+while (pool->order_block_count)
+  free(pool->order_blocks[--pool->order_block_count]);
+free(pool->order_blocks);
+pool->order_blocks = 0;
+free(pool->wide_orders);
+pool->wide_orders = 0;
+pool->wide_next = pool->wide_room = pool->free_wide = 0;
+pool->order_next   = pool->free_orders = 0;
+pool->chunk_next = pool->chunk_end = 0;
+pool->live_count = 0;
+}
+
+
 // Skip-list subroutines, found on the internet, modified to handle several lists (list is passed as an argument), added key/data separation, and added several routines.
 
-void initList(SkipList *list)
+void initList(SkipList *list,NodePool *pool,int descending)
 {
 int i;
 if ((list->hdr = malloc(sizeof(Node) + MAXLEVEL*sizeof(Node *))) == 0)
@@ -122,9 +302,11 @@ if ((list->hdr = malloc(sizeof(Node) + MAXLEVEL*sizeof(Node *))) == 0)
 for (i = 0; i <= MAXLEVEL; i++)
     list->hdr->forward[i] = list->hdr;
 list->listLevel = 0;
+list->descending = descending;
+list->pool = pool;
 }
 
-Node *insertNode(SkipList *list,char key[], struct list_entry_struct_type data)
+Node *insertNode(SkipList *list,long key, struct list_entry_struct_type data)
 {
 int i, newLevel;
 Node *update[MAXLEVEL+1];
@@ -133,7 +315,7 @@ Node *x;
 x = list->hdr;
 for (i = list->listLevel; i >= 0; i--)
     {
-    while (x->forward[i] != list->hdr && compLT(x->forward[i]->key, key))
+    while (x->forward[i] != list->hdr && compLT(list, x->forward[i]->key, key))
         x = x->forward[i];
     update[i] = x;
     }
@@ -149,12 +331,8 @@ if (newLevel > list->listLevel)
     list->listLevel = newLevel;
     }
 /* make new node */
-if ((x = malloc(sizeof(Node) + newLevel*sizeof(Node *))) == 0)
-    {
-    fputs("insufficient memory inserting node into list\n",stderr);
-    exit(11);
-    }
-strncpy(x->key,key,KEYLENGTH);
+x = allocate_node(list->pool,newLevel);
+x->key = key;
 x->data = data;
 /* update forward links */
 for (i = 0; i <= newLevel; i++)
@@ -165,7 +343,7 @@ for (i = 0; i <= newLevel; i++)
 return(x);
 }
 
-void deleteNode(SkipList *list,char key[])
+void deleteNode(SkipList *list,long key)
 {
 int i;
 Node *update[MAXLEVEL+1], *x;
@@ -173,7 +351,7 @@ Node *update[MAXLEVEL+1], *x;
 x = list->hdr;
 for (i = list->listLevel; i >= 0; i--)
     {
-    while (x->forward[i] != list->hdr && compLT(x->forward[i]->key, key))
+    while (x->forward[i] != list->hdr && compLT(list, x->forward[i]->key, key))
         x = x->forward[i];
     update[i] = x;
     }
@@ -187,19 +365,19 @@ for (i = 0; i <= list->listLevel; i++)
         break;
     update[i]->forward[i] = x->forward[i];
     }
-free (x);
+free_node(list->pool,x,i-1);  /* the loop stops one past the node's own height */
 /* adjust header level */
 while ((list->listLevel > 0) && (list->hdr->forward[list->listLevel] == list->hdr))
     list->listLevel--;
 }
 
-Node *findNode(SkipList *list,char key[])
+Node *findNode(SkipList *list,long key)
 {
 int i;
 Node *x = list->hdr;
 for (i = list->listLevel; i >= 0; i--)
     {
-    while (x->forward[i] != list->hdr && compLT(x->forward[i]->key, key))
+    while (x->forward[i] != list->hdr && compLT(list, x->forward[i]->key, key))
         x = x->forward[i];
     }
 x = x->forward[0];
@@ -232,353 +410,3879 @@ if (current_node->forward[0] == list->hdr)
 return(current_node->forward[0]);
 }
 
+Node *findNodeAfter(SkipList *list,long key)  // Returns the first node whose key comes after the given one, whether or not that key is on file.
+{
+int i;
+Node *x = list->hdr;
+for (i = list->listLevel; i >= 0; i--)
+    {
+    while (x->forward[i] != list->hdr && !compLT(list, key, x->forward[i]->key))
+        x = x->forward[i];
+    }
+x = x->forward[0];
+if (x != list->hdr)
+    return (x);
+return(0);
+}
 
-/*---------- Program-level subroutines ----------*/
-
-void reduce_size_or_delete_node(SkipList *list,char key[],long size)  // Fairly self explanatory name here....
+Node *findNodeBefore(SkipList *list,long key)  // Returns the last node whose key comes before the given one, whether or not that key is on file.
 {
-Node *list_pointer;
-long new_size;
+int i;
+Node *x = list->hdr;
+for (i = list->listLevel; i >= 0; i--)
+    {
+    while (x->forward[i] != list->hdr && compLT(list, x->forward[i]->key, key))
+        x = x->forward[i];
+    }
+if (x != list->hdr)
+    return (x);
+return(0);
+}
+
+
+/*---------- Order-ID hash table data structure and subroutines ----------*/
+
+// The order table used to be a third skip-list keyed on the right-justified order ID string, which meant a sprintf() and an
+// O(log n) walk of strncmp() calls on every reduce, followed by a second full walk to reduce or delete the entry.  It is now an
+// open-addressing (linear probing) hash table keyed on the order ID packed into a 64-bit integer, so that a reduce costs one probe
+// sequence and no string handling at all.  (The rare order ID that won't pack into 64 bits has an extra 16-bit word as well; see
+// FeedFormat.h.)  Deletion uses backward-shift instead of tombstones, so the table never degrades under
+// heavy add/cancel churn, and growth doubles the slot array and rehashes it in place.
 //
-if (!(list_pointer = findNode(list,key)))  // Failure to look up this entry?  Some sort of problem!
-  {
-  fputs("Problem looking up entry in list.\n",stderr);
-  exit(20);
-  }
-new_size = list_pointer->data.size - size;
-if (new_size < 0)
-  {
-  printf("New size < 0, so quitting, since the program should never allow this to happen.\n");
-  exit(21);
-  }
-if (new_size > 0)
-  list_pointer->data.size = new_size;  // The order was reduced but not eliminated, so just update its size.
-else
-  deleteNode(list,key);       // The order was reduced to 0.
+// Since slots move around, the orders themselves are kept in records of their own, and the slots just refer to them.  Each order
+// record points to its price level in turn, and each level keeps its orders in a doubly linked queue in arrival order, so a reduce
+// goes straight from the order to its level without looking the price up again, and a removal unlinks the order from its queue in
+// constant time.  The queues also give the number of orders at each level and each order's place in line.  A level's size can
+// run ahead of the total of its orders' sizes, since an add with a duplicate order ID still adds its shares to the level (as it
+// always has), but never behind it, so a level that empties has no orders left.
+//
+// With a whole market's worth of resting orders (ten million and more) the size of all this matters, so it is kept compact.  The
+// order records are numbered, and live in blocks of ORDER_BLOCK_SIZE that belong to the book's node pool; the queue links and
+// the table slots hold 32-bit record numbers instead of pointers, and record 0 stands for no order.  A slot is just the record
+// number and 32 bits of the key's hash, which is enough both to find the key's home slot (the table never has more than 2^32
+// slots) and to skip over nearly every other key in the probe sequence without looking at its record.  Prices (in cents, which
+// is the tick size) and sizes are kept in 32 bits; the odd order with a negative price or size, or one too big for 32 bits, keeps
+// both in a WideOrder of its own instead, which its record refers to by number, so order_price() and order_size() are used to
+// read them.  That makes an order 40 bytes, plus 16 to 32 bytes of table, and a level 24 bytes (see the memory report under -s).
+
+#define ORDER_TABLE_INITIAL_BITS 16  // Start with 65536 slots; the table doubles whenever it gets half full.
+#define ORDER_BLOCK_BITS         16  // Order records are allocated 65536 at a time.
+#define ORDER_BLOCK_SIZE         (1L << ORDER_BLOCK_BITS)
+#define ORDER_FIELD_MAX          0xffffffffL  // Largest price or size an order record can hold.
+
+struct order_slot_struct_type
+{
+unsigned int hash;         // The low 32 bits of mix_key() of the order's key.
+OrderIndex   order;        // Its record; 0 marks an empty slot.
+};
+typedef struct {
+    struct order_slot_struct_type *slots;
+    unsigned long mask;   // Slot count minus 1; the slot count is always a power of 2.
+    unsigned long count;  // Number of live orders.
+    NodePool      *pool;  // Where the order records come from.
+} OrderTable;
+
+
+unsigned long long mix_key(unsigned long long key)  // The 64-bit finalizer from MurmurHash3, which spreads the packed characters over the whole word.
+{
+key ^= key >> 33;
+key *= 0xff51afd7ed558ccdULL;
+key ^= key >> 33;
+key *= 0xc4ceb9fe1a85ec53ULL;
+key ^= key >> 33;
+return(key);
 }
 
-long total_price_from_list(SkipList *list,long target_size)  // Returns price of first x shares in list in cents.
+unsigned long long mix_order_key(unsigned long long key,unsigned short extra)  // The same for an order's key and extra word together; just mix_key() of the key when the word is 0.
 {
-long shares_remaining=target_size;
-long total_price_in_cents=0;
-Node *list_pointer=firstNode(list);
-//
-while (((target_size - shares_remaining) < target_size) && (list_pointer))
+return(mix_key(key ^ extra * 0x9e3779b97f4a7c15ULL));
+}
+
+static inline Order *order_at(NodePool *pool,OrderIndex index)  // The record with the given number.
+{
+return(&pool->order_blocks[index >> ORDER_BLOCK_BITS][index & (ORDER_BLOCK_SIZE - 1)]);
+}
+
+OrderIndex allocate_order(NodePool *pool)  // Hands out an order record, reusing a freed one if there is one.
+{
+OrderIndex index;
+if ((index = pool->free_orders))
+  pool->free_orders = order_at(pool,index)->next;
+else
   {
-  if (list_pointer->data.size >= shares_remaining)  // Does this node hold enough shares to fulfill the request for x shares?
+  if (!pool->order_next)  // Record 0 is never handed out, since 0 means no order.
+    pool->order_next = 1;
+  if (pool->order_next >> ORDER_BLOCK_BITS == pool->order_block_count)
     {
-    //if (DEBUG)
-    //  printf("This node (%ld/%ld) holds enough to fulfill the rest of the request (%ld).\n",list_pointer->data.size,list_pointer->data.price,shares_remaining);
-    total_price_in_cents += shares_remaining * list_pointer->data.price;  // Add to total and break out.
-    break;
+    if ((unsigned long)pool->order_block_count << ORDER_BLOCK_BITS > ORDER_FIELD_MAX - ORDER_BLOCK_SIZE ||
+        (pool->order_blocks = realloc(pool->order_blocks,(pool->order_block_count + 1) * sizeof(Order *))) == 0 ||
+        (pool->order_blocks[pool->order_block_count] = malloc(ORDER_BLOCK_SIZE * sizeof(Order))) == 0)
+      {
+      fputs("insufficient memory for order records\n",stderr);
+      exit(11);
+      }
+    pool->order_block_count++;
     }
-  //if (DEBUG)
-  //  printf("%ld shares remaining.  Using this entire node (%ld/%ld) to fulfill request, then moving on to the next.\n",shares_remaining,list_pointer->data.size,list_pointer->data.price);
-  total_price_in_cents += list_pointer->data.size * list_pointer->data.price;  // Use all the shares in the current node.
-  shares_remaining -= list_pointer->data.size;                                 // Reduce the shares remaining by the size of the current node, of course.
-  list_pointer = nextNode(list,list_pointer);
+  index = pool->order_next++;
   }
-if (DEBUG)
-  printf("Returning total price in cents of %ld for %ld shares.\n",total_price_in_cents,target_size);
-return(total_price_in_cents);
+if (++pool->order_live_count > pool->order_peak_count)
+  pool->order_peak_count = pool->order_live_count;
+return(index);
 }
 
-void print_cents_as_dollars(long cents)  // This is the fairly mechanical conversion from long cents to a dollar amount in string form.
+static inline long order_price(NodePool *pool,Order *order)
 {
-// A lot of trouble just to print something, but it certainly gets rid of those pesky floats and their potential computational inaccuracies throughout the program.
-char temp_string[16];
-if (cents < 100)      // This shouldn't happen in this program, but we'll be thorough anyway and ensure a minimum length of 3.
-  sprintf(temp_string,"%03ld",cents);
+return(order->wide ? pool->wide_orders[order->wide].price : order->price);
+}
+
+static inline long order_size(NodePool *pool,Order *order)
+{
+return(order->wide ? pool->wide_orders[order->wide].size : order->size);
+}
+
+unsigned int allocate_wide_order(NodePool *pool,long price,long size)  // Hands out a WideOrder for a price and size that don't fit in an order record.
+{
+unsigned int number;
+if ((number = pool->free_wide))
+  pool->free_wide = pool->wide_orders[number].price;
 else
-  sprintf(temp_string,"%ld",cents);
-dollar_string[0] = 0;
-strncpy(dollar_string,temp_string,strlen(temp_string)-2);
-dollar_string[strlen(temp_string)-2] = 0;
-strcat(dollar_string,".");  // All this trouble just to insert this one decimal point!  Well, almost.  :-)
-strcat(dollar_string+strlen(temp_string)-1,temp_string+strlen(temp_string)-2);
+  {
+  if (!pool->wide_next)
+    pool->wide_next = 1;
+  if (pool->wide_next >= pool->wide_room)
+    {
+    if (pool->wide_room > ORDER_FIELD_MAX / 2 ||
+        (pool->wide_orders = realloc(pool->wide_orders,(pool->wide_room = pool->wide_room ? 2 * pool->wide_room : 64) * sizeof(WideOrder))) == 0)
+      {
+      fputs("insufficient memory for order records\n",stderr);
+      exit(11);
+      }
+    }
+  number = pool->wide_next++;
+  }
+pool->wide_orders[number].price = price;
+pool->wide_orders[number].size  = size;
+return(number);
 }
 
-long list_total_size(SkipList *list)  // For use only when DEBUG is turned on.
+void free_order(NodePool *pool,OrderIndex index)
 {
-Node *list_pointer=firstNode(list);
-long list_total=0;
-while (list_pointer)
+if (order_at(pool,index)->wide)
   {
-  list_total += list_pointer->data.size;
-  list_pointer = nextNode(list,list_pointer);
+  pool->wide_orders[order_at(pool,index)->wide].price = pool->free_wide;
+  pool->free_wide = order_at(pool,index)->wide;
   }
-return(list_total);
+order_at(pool,index)->next = pool->free_orders;
+pool->free_orders = index;
+pool->order_live_count--;
 }
 
-long list_total_price(SkipList *list)  // For use only when DEBUG is turned on.
+void initOrderTable(OrderTable *table,NodePool *pool)
 {
-Node *list_pointer=firstNode(list);
-long list_total=0;
-while (list_pointer)
+if ((table->slots = calloc(1UL << ORDER_TABLE_INITIAL_BITS,sizeof(struct order_slot_struct_type))) == 0)
   {
-  list_total += list_pointer->data.size * list_pointer->data.price;
-  list_pointer = nextNode(list,list_pointer);
+  fputs("insufficient memory to init order table\n",stderr);
+  exit(12);
   }
-return(list_total);
+table->mask  = (1UL << ORDER_TABLE_INITIAL_BITS) - 1;
+table->count = 0;
+table->pool  = pool;
 }
 
+void level_append(NodePool *pool,Level *level,OrderIndex index)  // Puts an order at the back of a level's queue.
+{
+Order *order = order_at(pool,index);
+order->level    = level;
+order->next     = 0;
+order->previous = level->last_order;
+if (level->last_order)
+  order_at(pool,level->last_order)->next = index;
+else
+  level->first_order = index;
+level->last_order = index;
+level->order_count++;
+}
 
-/*------------------------------ Main Program ------------------------------*/
-int main(int argc,char *argv[])
+void level_remove(NodePool *pool,OrderIndex index)  // Takes an order out of its level's queue.
 {
-if (DEBUG)
-  fputs("DEBUG is on; expect volumninous output on the stdout channel.\n",stderr);
+Order *order = order_at(pool,index);
+Level *level = order->level;
+if (!level)  // An order for neither side is kept in the table but never queued anywhere.
+  return;
+if (order->previous)
+  order_at(pool,order->previous)->next = order->next;
+else
+  level->first_order = order->next;
+if (order->next)
+  order_at(pool,order->next)->previous = order->previous;
+else
+  level->last_order = order->previous;
+level->order_count--;
+}
 
-// Initialize the skip-list data structures.
-initList(&list_by_order_id);          // 
-initList(&list_by_price_ascending);   // 
-initList(&list_by_price_descending);  // 
+long order_shares_ahead(NodePool *pool,OrderIndex index)  // Shares queued ahead of an order at its level.
+{
+long shares=0;
+while ((index = order_at(pool,index)->previous))
+  shares += order_size(pool,order_at(pool,index));
+return(shares);
+}
 
+void order_table_place(OrderTable *table,struct order_slot_struct_type *entry)  // Drops an entry into the first free slot of its probe sequence.
+{
+unsigned long i = entry->hash & table->mask;
+while (table->slots[i].order)
+  i = (i + 1) & table->mask;
+table->slots[i] = *entry;
+}
 
-/*---------- Parse command line argument(s) ----------*/
-if (argc != 2)  // 1st argument is always program name; make sure that second (target size) has been supplied, but no more.
+void growOrderTable(OrderTable *table)  // Doubles the slot array and rehashes the existing entries within it.
+{
+unsigned long old_size = table->mask + 1, start, i, n;
+struct order_slot_struct_type entry;
+//
+if (old_size > 0x80000000UL || (table->slots = realloc(table->slots,2 * old_size * sizeof(struct order_slot_struct_type))) == 0)
   {
-  fputs("Invalid argument count; syntax:  ./Pricer ###          where ### is target size to use\n",stderr);
-  exit(1);
+  fputs("insufficient memory growing order table\n",stderr);
+  exit(13);
   }
-target_size = strtol(argv[1],(char **)NULL,10);  // Convert 1st passed argument to an integer.
-if (!target_size)  // Rudimentary error handling, but sufficient for this purpose.
+memset(table->slots + old_size,0,old_size * sizeof(struct order_slot_struct_type));
+table->mask = 2 * old_size - 1;
+// Walk the old half circularly, starting just past an empty slot so that every probe cluster is visited from its beginning.
+// Each entry is lifted out and re-placed under the new mask; it either lands at or before its old position in the low half,
+// or somewhere in the (so far untouched) high half, so no entry ever ends up behind a hole in its own probe sequence.
+for (start = 0; table->slots[start].order; start++);
+for (n = 1; n <= old_size; n++)
   {
-  fputs("Invalid argument; must be a long integer.\n",stderr);
-  exit(2);
+  i = (start + n) & (old_size - 1);
+  if (!table->slots[i].order)
+    continue;
+  entry = table->slots[i];
+  table->slots[i].order = 0;
+  order_table_place(table,&entry);
   }
+}
 
-/*-------------------- Main Loop --------------------*/
+struct order_slot_struct_type *order_table_find(OrderTable *table,unsigned long long key,unsigned short extra)
+{
+unsigned int hash = mix_order_key(key,extra);
+unsigned long i = hash & table->mask;
+Order *order;
+while (table->slots[i].order)
+  {
+  if (table->slots[i].hash == hash && (order = order_at(table->pool,table->slots[i].order))->key == key && order->key_extra == extra)
+    return(&table->slots[i]);
+  i = (i + 1) & table->mask;
+  }
+return(0);
+}
+
+void order_table_prefetch(OrderTable *table,unsigned long long key,unsigned short extra)  // Starts the slot a key hashes to on its way into the cache, ahead of a lookup (-A).
+{
+unsigned int hash = mix_order_key(key,extra);
+__builtin_prefetch(&table->slots[hash & table->mask]);
+}
+
+Order *order_table_guess(OrderTable *table,unsigned long long key,unsigned short extra)  // The record in the first slot with the key's hash, going by slots that ought to be in the cache by now; 0 if there isn't one.
+{                                                                                         // The hash alone usually picks out the right order, and this is only used for prefetching (-A), so the key isn't checked.
+unsigned int hash = mix_order_key(key,extra);
+unsigned long i = hash & table->mask;
+while (table->slots[i].order)
+  {
+  if (table->slots[i].hash == hash)
+    return(order_at(table->pool,table->slots[i].order));
+  i = (i + 1) & table->mask;
+  }
+return(0);
+}
+
+OrderIndex order_table_insert(OrderTable *table,unsigned long long key,unsigned short extra,char side,long price,long size,Level *level)  // Adds an order and queues it at its level, if it has one.
+{
+struct order_slot_struct_type entry;
+OrderIndex index;
+Order *order;
+if (order_table_find(table,key,extra))  // As with the skip-lists, duplicate keys are not allowed, so just return 0 in that case.
+  return(0);
+if (2 * (table->count + 1) > table->mask + 1)  // Keep the load factor at or below one half so probe sequences stay short.
+  growOrderTable(table);
+index = allocate_order(table->pool);
+order = order_at(table->pool,index);
+order->key   = key;
+order->key_extra = extra;
+order->side  = side;
+order->price = price;
+order->size  = size;
+order->wide  = price < 0 || price > ORDER_FIELD_MAX || size < 0 || size > ORDER_FIELD_MAX ? allocate_wide_order(table->pool,price,size) : 0;
+order->level = 0;
+if (level)
+  level_append(table->pool,level,index);
+entry.hash  = mix_order_key(key,extra);
+entry.order = index;
+table->count++;
+order_table_place(table,&entry);
+return(index);
+}
+
+void order_table_delete(OrderTable *table,struct order_slot_struct_type *slot)  // Backward-shift deletion; later members of the cluster slide into the gap.
+{
+unsigned long i = slot - table->slots, j = i, home;
 while (1)
   {
-  fgets(input_buffer,sizeof(input_buffer)-1,stdin);  // Accept input from stdin.  If this buffer isn't big enough, something's wrong with the input!
-  if (feof(stdin))
+  j = (j + 1) & table->mask;
+  if (!table->slots[j].order)
     break;
-  if (!input_buffer[0])  // Empty string?  That can't be right!
+  home = table->slots[j].hash & table->mask;
+  if (((j - home) & table->mask) >= ((j - i) & table->mask))  // Is the gap at i within this entry's probe sequence?  If so, move it back.
     {
-    fputs("Empty input string!  Ignoring.\n",stderr);
-    continue;
+    table->slots[i] = table->slots[j];
+    i = j;
     }
-  if (DEBUG)
-    printf("Input string: %s\n",input_buffer);
+  }
+table->slots[i].order = 0;
+table->count--;
+}
 
-  // Get the timestamp, operation type, and order id from the input line and proceed accordingly.
-  if ((timestamp_pointer = strtok(input_buffer," \n")) == NULL)  // Extract timestamp from input line.
-    {
-    fputs("No string found; continuing.\n",stderr);
-    continue;
-    }
-  if ((operation_type_pointer = strtok(NULL," \n")) == NULL)     // Extract operation type from input line.
-    {
-    fputs("No operation type field found; continuing.\n",stderr);
-    continue;
-    }
-  if ((order_id_pointer = strtok(NULL," \n")) == NULL)     // Extract order id from input line.
-    {
-    fputs("No order id field found; continuing.\n",stderr);
-    continue;
-    }
+void order_table_reduce(OrderTable *table,struct order_slot_struct_type *slot,long size)  // The order table's counterpart of reduce_size_or_delete_node().
+{
+OrderIndex index = slot->order;
+Order *order = order_at(table->pool,index);
+long remaining = order_size(table->pool,order) - size;
+if (remaining < 0)
+  {
+  printf("New size < 0, so quitting, since the program should never allow this to happen.\n");
+  exit(21);
+  }
+if (order->wide)
+  table->pool->wide_orders[order->wide].size = remaining;
+else
+  order->size = remaining;
+if (remaining > 0)  // The order was reduced but not eliminated, so that's all.
+  return;
+level_remove(table->pool,index);  // The order was reduced to 0, so it comes out of its queue and the table, and its record is freed.
+order_table_delete(table,slot);
+free_order(table->pool,index);
+}
 
-  // Now decide what course to take depending upon the value of the operation_type we found.
+long order_table_total_size(OrderTable *table)  // For use only when DEBUG is turned on.
+{
+unsigned long i;
+long table_total=0;
+for (i = 0; i <= table->mask; i++)
+  if (table->slots[i].order)
+    table_total += order_size(table->pool,order_at(table->pool,table->slots[i].order));
+return(table_total);
+}
 
-  if (operation_type_pointer[0] == 'A')  // Add order to book.
-    {
-    if ((side_pointer = strtok(NULL," \n")) == NULL)     // Extract side from input line.
-      {
-      fputs("No side field found; continuing.\n",stderr);
-      continue;
-      }
-    if ((price_pointer = strtok(NULL," \n")) == NULL)     // Extract price from input line.
-      {
-      fputs("No price field found; continuing.\n",stderr);
-      continue;
-      }
-    if ((size_pointer = strtok(NULL," \n")) == NULL)     // Extract size from input line.
-      {
-      fputs("No size field found; continuing.\n",stderr);
-      continue;
-      }
-    sprintf(key_string,"%*s",KEYLENGTH,order_id_pointer);  // Right justify the order ID so it sorts correctly and can be used as a key.
-    //
-    // Now populate this list entry's fields.
-    strcpy(list_entry.timestamp,timestamp_pointer);
-    strncpy(list_entry.order_id,order_id_pointer,10);
-    list_entry.side[0] = side_pointer[0];
-    list_entry.price =  strtol(price_pointer,(char **)NULL,10) * 100;  // Convert up to the period, then multiply by 100 to make room for the cents that we'll add on.
-    if (strchr(price_pointer,'.'))                                     // If a period is present in the input amount, then add the cents too.  This assumes two digits to the right of the decimal point, though, which is reasonable for dollar amounts.
-      list_entry.price += strtol(strchr(price_pointer,'.')+1,(char **)NULL,10);
-    list_entry.size  = strtol(size_pointer,(char **)NULL,10);
-    //
-    // Add to appropriate lists; all entries go into the order_id list, but into only one of the price lists.
-    //
-    insertNode(&list_by_order_id,key_string,list_entry);  // The 1st KEYLENGTH characters of key_string are the key and list_entry is the data.
-    //
-    if (list_entry.side[0] == 'S')  // We want to buy from lowest price to highest, so offers to sell go into this list.
-      {
-      sprintf(temp_string,  "%0*ld",KEYLENGTH,list_entry.price);  // Convert price to a string with length of KEYLENGTH.
-      if (!(list_pointer = findNode(&list_by_price_ascending,temp_string)))  // No entry in list for this price already?
-        insertNode(&list_by_price_ascending,temp_string,list_entry);
-      else
-        list_pointer->data.size += list_entry.size;
-      }
-    //
-    if (list_entry.side[0] == 'B')  // We want to sell from highest price to lowest, so offers to buy go into this list.
-      {
-      sprintf(temp_string,"%0*ld",KEYLENGTH,9999999999-list_entry.price);  // NOTE: This figure of 9999999999 is still a constant associated with KEYLENGTH that should be fixed.
-      if (!(list_pointer = findNode(&list_by_price_descending,temp_string)))  // No entry in list for this price already?
-        insertNode(&list_by_price_descending,temp_string,list_entry);
-      else
-        list_pointer->data.size += list_entry.size;
-      }
-    //
-    // Save relevant values in global variables to we can fall through to common code below.  timestamp and order_id can always be retrieved from the initial parsing pointers.
-    side[0] = list_entry.side[0];
-    price   = list_entry.price;
-    size    = list_entry.size;
-    //
-    // Update the current ask/bid figures so they match the totals of the corresponding price lists.
-    if (side[0] == 'B')
-      current_bid_count += size;
-    if (side[0] == 'S')
-      current_ask_count += size;
-    }
-  
-  if (operation_type_pointer[0] == 'R')  // Reduce/remove order.
-    {
-    if ((size_pointer = strtok(NULL," \n")) == NULL)     // Extract size from input line.
-      {
-      fputs("No size field found; continuing.\n",stderr);
-      continue;
-      }
-    sprintf(key_string,"%*s",KEYLENGTH,order_id_pointer);  // Right-justify order id so it sorts correctly and can be used as a key.
-    //
-    list_pointer = findNode(&list_by_order_id,key_string);  // We need to do to this lookup to find the side and price more than anything.
-    if (!list_pointer)  // Failed to look up supplied order id?
-      {
-      fputs("Failed to look up order id; continuing.\n",stderr);
-      continue;
-      }
-    side[0] = list_pointer->data.side[0];             // Save these three variables.
-    price   = list_pointer->data.price;               // We will need this to work with the two lists that are sorted by price.
-    size    = strtol(size_pointer,(char **)NULL,10);  // The amount to reduce the order size by.
-    if (size > list_pointer->data.size)  // Is pesky input data trying to reduce the order by more than its current size?
-      size   = list_pointer->data.size;  // If so, then skip that BS here and just use the original amount.
-    //
-    // Now reduce entries in appropriate lists, or, if their sizes fall to 0, delete them.
-    //
-    reduce_size_or_delete_node(&list_by_order_id,key_string,size);
-    //
-    if (side[0] == 'S')
-      {
-      sprintf(temp_string,"%0*ld",KEYLENGTH,price);
-      reduce_size_or_delete_node(&list_by_price_ascending,temp_string,size);
-      }
-    //
-    if (side[0] == 'B')
-      {
-      sprintf(temp_string,"%0*ld",KEYLENGTH,9999999999-price);  // Again, a place where KEYLENGTH should be used instead of this 9999999999 constant.
-      reduce_size_or_delete_node(&list_by_price_descending,temp_string,size);
-      }
-    // Update the current ask/bid figures so they match the totals of the corresponding price lists.
-    if (side[0] == 'B')
-      current_bid_count -= size;
-    if (side[0] == 'S')
-      current_ask_count -= size;
-    }
+long order_table_total_price(OrderTable *table)  // For use only when DEBUG is turned on.
+{
+unsigned long i;
+long table_total=0;
+for (i = 0; i <= table->mask; i++)
+  if (table->slots[i].order)
+    table_total += order_size(table->pool,order_at(table->pool,table->slots[i].order)) * order_price(table->pool,order_at(table->pool,table->slots[i].order));
+return(table_total);
+}
 
 
-  // Now, based upon what side the last add or reduce/remove operation referenced, decide what to do.
-  // These two blocks of code are so much identical that I am tempted to combine them into one subroutine,
-  // but we would end up passing about 5 variables to it, so I wonder if this won't suffice for now.  I'm
-  // sure a more clever mechanism could be come up with for representing the two sides of the book and their
-  // corresponding values and operations, but for a program as short as this one is, I'm not sure it would
-  // result in significantly reduced line count, so we'll leave it as a possibility for the future right now.
-  //
-  if (side[0] == 'B')  // The bid counts can have changed only if this last order_id processed was a bid, so only run this code in that case.
-    {
-    if (current_bid_count >= target_size)
-      {
-      returned_price = total_price_from_list(&list_by_price_descending,target_size);
-      if (returned_price != previous_bid_price)
-        {
-        print_cents_as_dollars(returned_price);  // This sets global variable dollar_string.
-        printf("%s S %s\n",timestamp_pointer,dollar_string);
-        }
-      previous_bid_price = returned_price;
-      }
-    else
-    if (previous_bid_count >= target_size)  // Bid count fell below the target size?
-      {
-      printf("%s S NA\n",timestamp_pointer);
-      previous_bid_price = 0;
-      }
-    previous_bid_count = current_bid_count;  // Reset this for the next go-around.
-    }
+/*---------- Price ladder data structure and subroutines ----------*/
 
-  if (side[0] == 'S')  // The ask counts can have changed only if this last order_id processed was an ask, so only run this code in that case.
-    {
-    if (current_ask_count >= target_size)
-      {
-      returned_price = total_price_from_list(&list_by_price_ascending,target_size);
-      if (returned_price != previous_ask_price)
-        {
-        print_cents_as_dollars(returned_price);  // This sets global variable dollar_string.
-        printf("%s B %s\n",timestamp_pointer,dollar_string);
-        }
-      previous_ask_price = returned_price;
-      }
-    else
-    if (previous_ask_count >= target_size)  // Ask count fell below the target size?
-      {
-      printf("%s B NA\n",timestamp_pointer);
-      previous_ask_price = 0;
-      }
-    previous_ask_count = current_ask_count;
-    }
-
-
-  if (DEBUG)  // If DEBUG is turned on, then print totals and do consistency checks after every single input line has been processed.
-    {         // This code could be omitted from the final program, but is left here as an illustration of the program development process.
-    printf("Current ask count: %ld\n",current_ask_count);
-    printf("Current bid count: %ld\n",current_bid_count);
-    //
-    // Show total sizes in all three lists.
-    temp_long = list_total_size(&list_by_order_id);
-    printf("List by order id size total: %ld\n",temp_long);
-    temp_long = list_total_size(&list_by_price_ascending);
-    printf("List by price ascending size total: %ld\n",temp_long);
-    temp_long = list_total_size(&list_by_price_descending);
-    printf("List by price descending size total: %ld\n",temp_long);
-    //
-    // Check to make sure that sizes in the two price-sorted lists add up to the total size of the order-id-sorted list.
-    if (list_total_size(&list_by_price_ascending) + list_total_size(&list_by_price_descending) != list_total_size(&list_by_order_id))
-      fputs("ERROR: The two price lists' sizes don't add up to the order_id list's total.\n",stderr);
-    // The next two statements check to make sure that the count variables we maintain never vary from the amounts in the lists, since they are, after all, duplicate data.
-    if (current_ask_count != list_total_size(&list_by_price_ascending))
-      fputs("ERROR: current_ask_count <> total size of list_by_price_ascending!\n",stderr);
-    if (current_bid_count != list_total_size(&list_by_price_descending))
-      fputs("ERROR: current_bid_count <> total size of list_by_price_descending!\n",stderr);
-    //
-    // Show total prices in all three lists.
-    temp_long = list_total_price(&list_by_order_id);
-    printf("List by order id price total: %ld\n",temp_long);
-    temp_long = list_total_price(&list_by_price_ascending);
-    printf("List by price ascending price total: %ld\n",temp_long);
-    temp_long = list_total_price(&list_by_price_descending);
-    printf("List by price descending price total: %ld\n",temp_long);
-    //
-    // As before, check that the total prices in the two price-sorted lists add up to the total price of the order-id-sorted list.
-    if (list_total_price(&list_by_price_ascending) + list_total_price(&list_by_price_descending) != list_total_price(&list_by_order_id))
-      fputs("ERROR: The two price lists' prices don't add up to the order_id list's total.\n",stderr);
-    // There are no variables that hold the total prices, as there are for the counts, so nothing to check here.
-    //
-    printf("-----------------------------------------------------------------------\n");
-    }
-
-
-  // Loop back around for the next line of input!
+// Each side of the book is kept in a price ladder: a contiguous array of price levels indexed by the tick (cent) offset of the
+// price from the ladder's anchor, so adding to or reducing a level is a plain array access instead of a sprintf() and a skip-list
+// search.  A three-level occupancy bitmap sits over the array (one bit per level, one bit per non-empty bitmap word, and one bit
+// per non-empty second-level word), so the best level and the next populated level in either direction can be found with a
+// handful of count-trailing/leading-zero instructions no matter how sparse the book is.  Prices that fall outside the ladder's
+// window go into the original skip-list (in descending order for bids), which serves as the overflow structure.  Whenever the
+// window is empty the anchor is recentered around the price at hand, and any overflow levels that land inside the new window are
+// moved into it.
+//
+// The two sides differ only in which way is better, so each routine that cares is written once and takes the side ('S' or 'B')
+// as an argument.  Those routines are always inlined, and the book code calls them with a constant side, so the compiler drops
+// every test of the side and turns out a separate copy for each side with plain integer comparisons, the way a C++ template
+// would be instantiated once per side.  Code that isn't speed-critical just passes ladder->side.
+
+#define LADDER_BITS  16                  // The window covers 2^16 cents, or $655.36, on each side; the bitmap layout allows anything from 12 to 18.
+#define LADDER_TICKS (1L << LADDER_BITS)
+#define NO_PRICE     -1L                 // Returned by the ladder walking routines when there is no level, and used to start a walk from the best level.
+#define SIDE_INLINE  static inline __attribute__((always_inline))
+#define BETTER_PRICE(side,a,b)   ((side) == 'S' ? (a) < (b) : (a) > (b))                  // Is price a better than price b on this side?
+#define DEPTH_POSITION(side,i)   ((side) == 'S' ? (i) : LADDER_TICKS - 1 - (i))          // Window index i counted from the best end of the window.
+
+typedef struct {
+    char               side;                           // 'B'uy ladders are walked from the highest price down, 'S'ell ladders from the lowest up.
+    long               anchor;                         // Price in cents of ladder index 0.
+    long               level_count;                    // Number of populated levels inside the window.
+    Level              levels[LADDER_TICKS];           // The level at each price in the window.
+    unsigned long long bits0[LADDER_TICKS >> 6];       // One bit per level.
+    unsigned long long bits1[LADDER_TICKS >> 12];      // One bit per non-zero bits0 word.
+    unsigned long long bits2;                          // One bit per non-zero bits1 word.
+    SkipList           overflow;                       // Levels outside the window, best first.
+    int                indexed;                        // Non-zero if the cumulative-depth index below is being maintained.
+    long               index_size[LADDER_TICKS+1];     // Fenwick tree of share counts by depth position (see ladder_index_update()).
+    long               index_notional[LADDER_TICKS+1]; // Fenwick tree of share count times price, likewise.
+} PriceLadder;
+
+
+void initLadder(PriceLadder *ladder,char side,NodePool *pool)  // The ladder must start out zeroed, as globals and calloc()ed memory are; clearing it here would touch every page of the window.
+{
+ladder->side = side;
+initList(&ladder->overflow,pool,side == 'B');
+}
+
+SIDE_INLINE void ladder_index_update(PriceLadder *ladder,long i,long size,const char side)  // Adds size shares at window index i to the cumulative-depth index, if there is one.
+{
+// The index is a pair of Fenwick trees over depth position, which is the window index for asks and the window index counted down
+// from the top for bids, so that position 1 is always the best price in the window.  Prefix sums over it give the share count and
+// cost of everything down to a given depth, which lets any target size be priced in O(log L) (see indexed_price_from_ladder()).
+long position = DEPTH_POSITION(side,i) + 1, notional = size * (ladder->anchor + i);
+if (!ladder->indexed)
+  return;
+for (; position <= LADDER_TICKS; position += position & -position)
+  {
+  ladder->index_size[position]     += size;
+  ladder->index_notional[position] += notional;
+  }
+}
+
+void ladder_set_bit(PriceLadder *ladder,long i)
+{
+ladder->bits0[i >> 6]  |= 1ULL << (i & 63);
+ladder->bits1[i >> 12] |= 1ULL << ((i >> 6) & 63);
+ladder->bits2          |= 1ULL << (i >> 12);
+}
+
+void ladder_clear_bit(PriceLadder *ladder,long i)
+{
+if ((ladder->bits0[i >> 6] &= ~(1ULL << (i & 63))))
+  return;
+if ((ladder->bits1[i >> 12] &= ~(1ULL << ((i >> 6) & 63))))
+  return;
+ladder->bits2 &= ~(1ULL << (i >> 12));
+}
+
+long ladder_first_at_or_above(PriceLadder *ladder,long i)  // Lowest populated index >= i, or -1.
+{
+unsigned long long m;
+long w = i >> 6, x;
+if (i >= LADDER_TICKS)
+  return(-1);
+if ((m = ladder->bits0[w] & (~0ULL << (i & 63))))  // Anything left in this word?
+  return((w << 6) + __builtin_ctzll(m));
+if (++w < (LADDER_TICKS >> 6) && (m = ladder->bits1[w >> 6] & (~0ULL << (w & 63))))  // Anything left in this group of words?
+  {
+  w = ((w >> 6) << 6) + __builtin_ctzll(m);
+  return((w << 6) + __builtin_ctzll(ladder->bits0[w]));
+  }
+x = (i >> 12) + 1;
+if (x < (LADDER_TICKS >> 12) && (m = ladder->bits2 & (~0ULL << x)))  // Anything in any later group?
+  {
+  x = __builtin_ctzll(m);
+  w = (x << 6) + __builtin_ctzll(ladder->bits1[x]);
+  return((w << 6) + __builtin_ctzll(ladder->bits0[w]));
   }
+return(-1);
+}
 
+long ladder_last_at_or_below(PriceLadder *ladder,long i)  // Highest populated index <= i, or -1.
+{
+unsigned long long m;
+long w = i >> 6, x;
+if (i < 0)
+  return(-1);
+if ((m = ladder->bits0[w] & (~0ULL >> (63 - (i & 63)))))
+  return((w << 6) + 63 - __builtin_clzll(m));
+if (--w >= 0 && (m = ladder->bits1[w >> 6] & (~0ULL >> (63 - (w & 63)))))
+  {
+  w = ((w >> 6) << 6) + 63 - __builtin_clzll(m);
+  return((w << 6) + 63 - __builtin_clzll(ladder->bits0[w]));
+  }
+x = (i >> 12) - 1;
+if (x >= 0 && (m = ladder->bits2 & (~0ULL >> (63 - x))))
+  {
+  x = 63 - __builtin_clzll(m);
+  w = (x << 6) + 63 - __builtin_clzll(ladder->bits1[x]);
+  return((w << 6) + 63 - __builtin_clzll(ladder->bits0[w]));
+  }
+return(-1);
+}
+
+SIDE_INLINE long ladder_next_worse(PriceLadder *ladder,long price,const char side)  // Next populated price past the given one, walking away from the best level; NO_PRICE starts at the best level.
+{
+long i, in_window=NO_PRICE, in_overflow=NO_PRICE;
+Node *node;
+//
+if (ladder->level_count)
+  {
+  if (side == 'S')
+    i = ladder_first_at_or_above(ladder,price == NO_PRICE ? 0 : (price + 1 - ladder->anchor < 0 ? 0 : price + 1 - ladder->anchor));
+  else
+    i = ladder_last_at_or_below(ladder,price == NO_PRICE ? LADDER_TICKS - 1 : (price - 1 - ladder->anchor >= LADDER_TICKS ? LADDER_TICKS - 1 : price - 1 - ladder->anchor));
+  if (i >= 0)
+    in_window = ladder->anchor + i;
+  }
+if (firstNode(&ladder->overflow) != ladder->overflow.hdr)  // The overflow list is normally empty, so only search it when it isn't.
+  {
+  if ((node = price == NO_PRICE ? firstNode(&ladder->overflow) : findNodeAfter(&ladder->overflow,price)))
+    in_overflow = node->key;
+  }
+if (in_window == NO_PRICE)
+  return(in_overflow);
+if (in_overflow == NO_PRICE)
+  return(in_window);
+return(BETTER_PRICE(side,in_overflow,in_window) ? in_overflow : in_window);
+}
+
+SIDE_INLINE long ladder_next_better(PriceLadder *ladder,long price,const char side)  // Next populated price before the given one, walking back toward the best level.
+{
+long i=-1, in_window=NO_PRICE, in_overflow=NO_PRICE;
+Node *node;
+//
+if (ladder->level_count)
+  {
+  if (side == 'S' && price - 1 - ladder->anchor >= 0)
+    i = ladder_last_at_or_below(ladder,price - 1 - ladder->anchor >= LADDER_TICKS ? LADDER_TICKS - 1 : price - 1 - ladder->anchor);
+  if (side == 'B' && price + 1 - ladder->anchor < LADDER_TICKS)
+    i = ladder_first_at_or_above(ladder,price + 1 - ladder->anchor < 0 ? 0 : price + 1 - ladder->anchor);
+  if (i >= 0)
+    in_window = ladder->anchor + i;
+  }
+if (firstNode(&ladder->overflow) != ladder->overflow.hdr)
+  {
+  if ((node = findNodeBefore(&ladder->overflow,price)))
+    in_overflow = node->key;
+  }
+if (in_window == NO_PRICE)
+  return(in_overflow);
+if (in_overflow == NO_PRICE)
+  return(in_window);
+return(BETTER_PRICE(side,in_overflow,in_window) ? in_window : in_overflow);
+}
+
+Level *ladder_find_level(PriceLadder *ladder,long price)  // The level at a price, wherever it is kept, or 0 if there isn't one.
+{
+Node *node;
+if (price >= ladder->anchor && price - ladder->anchor < LADDER_TICKS)
+  return(ladder->levels[price - ladder->anchor].size ? &ladder->levels[price - ladder->anchor] : 0);
+return((node = findNode(&ladder->overflow,price)) ? &node->data.level : 0);
+}
+
+static inline long ladder_level_size(PriceLadder *ladder,long price)  // Share count at a price, wherever it is kept.
+{
+if (price >= ladder->anchor && price - ladder->anchor < LADDER_TICKS)  // The usual case, which needs no call.
+  return(ladder->levels[price - ladder->anchor].size);
+return(ladder_find_level(ladder,price) ? ladder_find_level(ladder,price)->size : 0);
+}
+
+void ladder_recenter(PriceLadder *ladder,long price)  // Moves the (empty) window so it is centered on price, and pulls in any overflow levels that now fit.
+{
+Node *node, *next;
+Level *level;
+OrderIndex index;
+ladder->anchor = price - LADDER_TICKS / 2;
+if (ladder->anchor < 0)
+  ladder->anchor = 0;
+for (node = firstNode(&ladder->overflow); node != ladder->overflow.hdr && node; node = next)
+  {
+  next = nextNode(&ladder->overflow,node);
+  if (node->key < ladder->anchor || node->key - ladder->anchor >= LADDER_TICKS)
+    continue;
+  level  = &ladder->levels[node->key - ladder->anchor];
+  *level = node->data.level;
+  for (index = level->first_order; index; index = order_at(ladder->overflow.pool,index)->next)  // The level has moved, so its orders have to be told where it went.
+    order_at(ladder->overflow.pool,index)->level = level;
+  ladder_set_bit(ladder,node->key - ladder->anchor);
+  ladder_index_update(ladder,node->key - ladder->anchor,level->size,ladder->side);
+  ladder->level_count++;
+  deleteNode(&ladder->overflow,node->key);
+  }
+}
+
+Level *ladder_window_level(PriceLadder *ladder,long price)  // Where the level at price would be in the window, or 0 if it would be outside it; for prefetching (-A).
+{
+return(price >= ladder->anchor && price - ladder->anchor < LADDER_TICKS ? &ladder->levels[price - ladder->anchor] : 0);
+}
+
+SIDE_INLINE Level *ladder_add(PriceLadder *ladder,long price,long size,const char side)  // Adds shares to the level at price, creating the level if need be; returns the level.
+{
+struct list_entry_struct_type list_entry;
+Node *node;
+long i;
+//
+if (!ladder->level_count && (price < ladder->anchor || price - ladder->anchor >= LADDER_TICKS))  // Empty window and the price is outside it?  Move the window.
+  ladder_recenter(ladder,price);
+i = price - ladder->anchor;
+if (i >= 0 && i < LADDER_TICKS)
+  {
+  if (!ladder->levels[i].size)
+    {
+    ladder_set_bit(ladder,i);
+    ladder->level_count++;
+    }
+  ladder->levels[i].size += size;
+  ladder_index_update(ladder,i,size,side);
+  return(&ladder->levels[i]);
+  }
+if (!(node = findNode(&ladder->overflow,price)))
+  {
+  memset(&list_entry,0,sizeof(list_entry));
+  list_entry.side[0] = side;
+  node = insertNode(&ladder->overflow,price,list_entry);
+  }
+node->data.level.size += size;
+return(&node->data.level);
+}
+
+SIDE_INLINE void ladder_reduce(PriceLadder *ladder,Level *level,long price,long size,const char side)  // Takes shares off a level, given the level itself; the level is gone if it empties.
+{
+long i;
+Node *node;
+//
+if (level->size - size < 0)
+  {
+  printf("New size < 0, so quitting, since the program should never allow this to happen.\n");
+  exit(21);
+  }
+if (level < ladder->levels || level >= ladder->levels + LADDER_TICKS)  // An overflow level, which lives in a skip-list node.
+  {
+  if ((level->size -= size))
+    return;
+  deleteNode(&ladder->overflow,price);
+  return;
+  }
+i = level - ladder->levels;
+ladder_index_update(ladder,i,-size,side);
+if ((level->size -= size))
+  return;
+ladder_clear_bit(ladder,i);  // The level was reduced to 0.
+if (!--ladder->level_count && (node = firstNode(&ladder->overflow)) != ladder->overflow.hdr)  // Window now empty but levels left outside it?
+  ladder_recenter(ladder,node->key);                                                       // Then recenter on the best of them.
+}
+
+long ladder_total_size(PriceLadder *ladder)  // For use only when DEBUG is turned on.
+{
+long price=NO_PRICE, ladder_total=0;
+while ((price = ladder_next_worse(ladder,price,ladder->side)) != NO_PRICE)
+  ladder_total += ladder_level_size(ladder,price);
+return(ladder_total);
+}
+
+long ladder_total_price(PriceLadder *ladder)  // For use only when DEBUG is turned on.
+{
+long price=NO_PRICE, ladder_total=0;
+while ((price = ladder_next_worse(ladder,price,ladder->side)) != NO_PRICE)
+  ladder_total += ladder_level_size(ladder,price) * price;
+return(ladder_total);
+}
+
+long ladder_check_queues(PriceLadder *ladder)  // For use only when DEBUG is turned on; checks each level's queue, and returns how many orders are queued in all.
+{
+long price=NO_PRICE, count, ladder_total=0;
+NodePool *pool = ladder->overflow.pool;
+Level *level;
+OrderIndex index;
+while ((price = ladder_next_worse(ladder,price,ladder->side)) != NO_PRICE)
+  {
+  level = ladder_find_level(ladder,price);
+  for (count = 0, index = level->first_order; index; index = order_at(pool,index)->next, count++)
+    if (order_at(pool,index)->level != level || order_price(pool,order_at(pool,index)) != price)
+      fputs("ERROR: An order is queued at a level other than its own!\n",stderr);
+  if (count != level->order_count ||
+      (level->last_order && order_shares_ahead(pool,level->last_order) + order_size(pool,order_at(pool,level->last_order)) > level->size))
+    fputs("ERROR: A level's order count or queued shares don't match its queue!\n",stderr);
+  ladder_total += count;
+  }
+return(ladder_total);
+}
+
+
+/*---------- Fill frontier data structure and subroutines ----------*/
+
+// Re-walking the depth of a side from its best level after every change gets expensive for large target sizes, and most changes
+// (say, a one-share reduce ten dollars off the market) can't affect the price of the target size anyway.  So each side keeps a
+// fill frontier: the level at which the target size runs out, how many shares are taken from that level, and the running cost
+// of the shares taken.  Every level better than the frontier level is taken in full.  An add or reduce beyond the frontier is
+// skipped without looking at anything else; one at or inside it adjusts the running totals and then moves the frontier back
+// (after an add) or forward (after a reduce) only as far as the shares involved require.
+
+typedef struct {
+    PriceLadder *ladder;    // The side of the book this frontier belongs to.
+    long        target;     // Number of shares to be filled.
+    long        price;      // Price of the frontier level, or NO_PRICE if nothing is taken.
+    long        taken;      // Shares taken from the frontier level.
+    long        filled;     // Shares taken in all; this falls short of target only when the side doesn't hold that many shares.
+    long        notional;   // Price in cents of the shares taken.
+} FillFrontier;
+
+
+void initFrontier(FillFrontier *frontier,PriceLadder *ladder,long target)
+{
+memset(frontier,0,sizeof(FillFrontier));
+frontier->ladder = ladder;
+frontier->target = target;
+frontier->price  = NO_PRICE;
+}
+
+void frontier_take(FillFrontier *frontier,long shares)  // Takes shares from the frontier level (or gives them back, if negative).
+{
+frontier->taken    += shares;
+frontier->filled   += shares;
+frontier->notional += shares * frontier->price;
+}
+
+SIDE_INLINE void frontier_add(FillFrontier *frontier,long price,long size,const char side)  // Call after adding size shares to the ladder at price.
+{
+long shares;
+//
+if (frontier->price == NO_PRICE || BETTER_PRICE(side,frontier->price,price))  // Beyond the frontier?
+  {
+  if (frontier->filled == frontier->target)  // Target already filled, so there is nothing to do.
+    return;
+  frontier->price = price;  // The side ran out before the target did, so this must be the new last level.
+  frontier->taken = 0;
+  }
+if (price == frontier->price)
+  {
+  shares = frontier->target - frontier->filled;
+  frontier_take(frontier,size < shares ? size : shares);
+  return;
+  }
+// The shares went in ahead of the frontier, so they are taken in full and the same number must come off the back.
+frontier->filled   += size;
+frontier->notional += size * price;
+while (frontier->filled > frontier->target)
+  {
+  shares = frontier->filled - frontier->target;
+  frontier_take(frontier,-(shares < frontier->taken ? shares : frontier->taken));
+  if (!frontier->taken)  // Frontier level no longer used at all?  Step back to the previous level, which is taken in full.
+    {
+    frontier->price = ladder_next_better(frontier->ladder,frontier->price,side);
+    frontier->taken = ladder_level_size(frontier->ladder,frontier->price);
+    }
+  }
+}
+
+SIDE_INLINE void frontier_reduce(FillFrontier *frontier,long price,long size,const char side)  // Call after reducing the ladder at price by size shares.
+{
+long shares;
+//
+if (frontier->price == NO_PRICE || BETTER_PRICE(side,frontier->price,price))  // Beyond the frontier?  Then there is nothing to do.
+  return;
+if (price == frontier->price)
+  {
+  shares = ladder_level_size(frontier->ladder,price);
+  if (frontier->taken > shares)
+    frontier_take(frontier,shares - frontier->taken);
+  }
+else
+  {
+  frontier->filled   -= size;  // The shares came from a level that was taken in full.
+  frontier->notional -= size * price;
+  }
+// Now move forward to make up the shortfall, for as long as there are levels to take from.
+while (frontier->filled < frontier->target)
+  {
+  shares = ladder_level_size(frontier->ladder,frontier->price) - frontier->taken;
+  if (shares > 0)
+    {
+    frontier_take(frontier,shares < frontier->target - frontier->filled ? shares : frontier->target - frontier->filled);
+    continue;
+    }
+  if ((shares = ladder_next_worse(frontier->ladder,frontier->price,side)) == NO_PRICE)
+    break;
+  frontier->price = shares;
+  frontier->taken = 0;
+  }
+if (!frontier->taken)  // Did the frontier level empty out with nothing beyond it?  Then step back to the last level actually used.
+  {
+  frontier->price = ladder_next_better(frontier->ladder,frontier->price,side);
+  frontier->taken = frontier->price == NO_PRICE ? 0 : ladder_level_size(frontier->ladder,frontier->price);
+  }
+}
+
+
+/*---------- Book data structure and subroutines ----------*/
+
+// Everything that goes into one instrument's book: the order table, and for each side a price ladder, its fill frontier, and
+// the figures kept alongside them for deciding when to print.  There is a single book normally, and one per symbol in
+// multi-symbol mode (see "Multi-symbol subroutines").  BOOK_SIDE() picks one side out; given a constant side, it costs nothing.
+
+typedef struct {
+    PriceLadder  ladder;
+    FillFrontier frontier;                                                // Only used when there is one target size.
+    long         current_count, previous_count;                           // We will track these figures here in spite of the fact that some of this is duplicate data,
+                                                                          // because tallying up the figures from the lists after every operation would be, well, slow.
+    long         previous_price[MAX_TARGETS];                             // One entry per target size; used only for deciding whether the price has changed and we should print something.
+} BookSide;
+
+typedef struct {
+    OrderTable   order_table;
+    BookSide     ask, bid;                                                // The 'S'ell side and the 'B'uy side of the book.
+    char         last_side;                                               // Side of the last order worked on, which a message with an unknown operation type is taken to be for.
+    char         pending_sides;                                           // With -C, the sides changed by the batch not yet priced: 1 for the asks, 2 for the bids.
+    unsigned long long pending_bucket;                                    // The time bucket of that batch.
+    Message      pending_message;                                         // Its latest message, whose timestamp the batch's output lines carry.
+    char         symbol[FEED_ORDER_ID_MAX_LENGTH+1];                      // Printed at the front of each output line in multi-symbol mode, and with -V -e; empty otherwise.
+    int          symbol_length;
+    struct book_snapshot_file_struct_type *snapshot;                      // Where the book is published with -S, or NULL.
+    struct rolling_struct_type *rolling;                                  // Its rolling statistics with -R, or NULL.
+} Book;
+Book book;  // The book, when there is only one.
+#define BOOK_SIDE(book,side) ((side) == 'S' ? &(book)->ask : &(book)->bid)
+long memory_table_bytes, memory_record_bytes, memory_window_levels;  // Totals over all the books, for the memory report under -s.
+
+
+void initBook(Book *book,NodePool *pool)  // As with the ladders, the book must start out zeroed.  The target sizes must be known by now.
+{
+initOrderTable(&book->order_table,pool);
+initLadder(&book->ask.ladder,'S',pool);
+initLadder(&book->bid.ladder,'B',pool);
+if (target_count == 1)  // One target size is priced from the fill frontiers.
+  {
+  initFrontier(&book->ask.frontier,&book->ask.ladder,target_sizes[0]);
+  initFrontier(&book->bid.frontier,&book->bid.ladder,target_sizes[0]);
+  }
+else  // Several target sizes are priced from the ladders' cumulative-depth indexes instead of one frontier apiece.
+  {
+  book->ask.ladder.indexed = 1;
+  book->bid.ladder.indexed = 1;
+  }
+}
+
+void tally_book_memory(Book *book)  // Adds a book's order table and window levels to the memory report's totals.
+{
+if (!book->order_table.slots)
+  return;
+memory_table_bytes   += (book->order_table.mask + 1) * sizeof(struct order_slot_struct_type);
+memory_window_levels += book->ask.ladder.level_count + book->bid.ladder.level_count;
+}
+
+void tally_pool_memory(NodePool *pool)  // Likewise for the order records allocated from a node pool.
+{
+memory_record_bytes += pool->order_block_count * ORDER_BLOCK_SIZE * sizeof(Order);
+}
+
+
+/*---------- Input scanning subroutines ----------*/
+
+// Input used to be read a line at a time with fgets() and split up with strtok(), with the numbers converted by strtol().  For
+// replays of whole days' files that costs far more than the book updates do, so the input is now scanned in place: a file named
+// with -f is memory-mapped in its entirety, and stdin is read in large blocks, with any partial line at the end of a block carried
+// over to the start of the next.  Lines are found eight bytes at a time, and fields are picked out and converted to integers by
+// hand as they are needed, without copying anything or calling into the C library.  Nothing is ever written into the input, so a
+// mapped file can stay read-only.  As with the fgets() loop, a last line with no newline on the end is ignored.
+
+#define INPUT_BLOCK_SIZE (1L << 20)  // Size of each read from stdin.  The buffer is doubled if a single line ever outgrows it.
+
+__thread char *input_data;         // Start of the input not yet scanned.
+__thread char *input_data_end;     // End of the input read in so far.
+__thread char *input_block;        // The buffer for reading stdin.
+__thread long  input_block_size;   // Its size.
+__thread int   input_is_mapped;    // Non-zero if the input is a memory-mapped file, in which case there is nothing more to read once input_data_end is reached.
+__thread long  input_bytes_read;   // Bytes consumed so far, for the statistics report.
+
+// With -L address, the feed comes in over a socket instead of stdin: a Unix-domain socket if the address has a '/' in it, and
+// TCP on [host:]port otherwise, the host defaulting to 127.0.0.1.  Pricer listens, takes the first connection as the feed, and
+// reads it without ever blocking in read(), edge-triggered through epoll.  Each wakeup drains the socket into a large buffer,
+// everything in the buffer is parsed before the socket is read again, and a partial line or record at the end of a read is
+// carried over just as with stdin.  Only when there is nothing left at all does the program wait on epoll, having written out
+// whatever output was waiting first.  The counters below (wakeups, the deepest the queue has been, counting both the kernel's
+// socket buffer and ours, how often a read filled the buffer with more still waiting, meaning the book had fallen behind the
+// feed, and what was dropped) are printed on stderr under -s, and at any time when the program gets SIGUSR2.
+
+#define LIVE_BLOCK_SIZE  (16L << 20)  // Size of the buffer a live feed is read into, enough for a market-open burst in one gulp.
+#define LIVE_SOCKET_SIZE (8 << 20)    // Size asked for the socket's kernel buffer, for the same reason.
+
+char  *live_address;                 // Set by -L.
+__thread int   input_descriptor;     // Where refill_input() reads from: stdin, or the socket of a live feed.
+__thread int   input_is_live;        // Set when that is a live feed's socket.
+__thread int   live_epoll;           // The epoll instance watching the feed socket.
+__thread int   live_readable;        // Non-zero while the socket may still have more to read; with edge-triggering, epoll won't say so again.
+__thread int   live_closed;          // Set once the other end has closed the connection.
+__thread long  live_wakeups, live_reads, live_bytes, live_queue_peak, live_behind_count, live_dropped_bytes;
+__thread long  input_lines_dropped;  // Input lines skipped as unusable, live or not.
+volatile sig_atomic_t live_report_wanted;  // Set by SIGUSR2.
+
+
+void request_live_report(int signal_number)
+{
+(void)signal_number;
+live_report_wanted = 1;
+}
+
+long live_queue_depth(void)  // Bytes of the feed waiting to be parsed: still in the socket, and read in but not yet scanned.
+{
+int waiting=0;
+ioctl(input_descriptor,FIONREAD,&waiting);
+return(waiting + (input_data_end - input_data));
+}
+
+void live_report(void)
+{
+live_report_wanted = 0;
+fprintf(stderr,"Live feed: %ld wakeups, %ld reads, %ld bytes; queue depth %ld bytes, %ld peak; fell behind %ld times; dropped %ld lines, %ld bytes at close\n",
+        live_wakeups,live_reads,live_bytes,live_queue_depth(),live_queue_peak,live_behind_count,input_lines_dropped,live_dropped_bytes);
+}
+
+void open_live_feed(char *address)  // Listens on the address, and takes the first connection made to it as the input.
+{
+struct sockaddr_un unix_address;
+struct sockaddr_in tcp_address;
+struct epoll_event event;
+char host[64], *colon = strrchr(address,':');
+int listener, size=LIVE_SOCKET_SIZE, one=1, bound;
+//
+signal(SIGUSR2,request_live_report);
+if (strchr(address,'/'))
+  {
+  memset(&unix_address,0,sizeof(unix_address));
+  unix_address.sun_family = AF_UNIX;
+  snprintf(unix_address.sun_path,sizeof(unix_address.sun_path),"%s",address);
+  unlink(address);  // A socket left behind by an earlier run would be in the way.
+  listener = socket(AF_UNIX,SOCK_STREAM,0);
+  bound = listener >= 0 && strlen(address) < sizeof(unix_address.sun_path) && bind(listener,(struct sockaddr *)&unix_address,sizeof(unix_address)) == 0;
+  }
+else
+  {
+  memset(&tcp_address,0,sizeof(tcp_address));
+  tcp_address.sin_family      = AF_INET;
+  tcp_address.sin_port        = htons(atoi(colon ? colon + 1 : address));
+  tcp_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  snprintf(host,sizeof(host),"%.*s",colon ? (int)(colon - address) : 0,address);
+  listener = socket(AF_INET,SOCK_STREAM,0);
+  setsockopt(listener,SOL_SOCKET,SO_REUSEADDR,&one,sizeof(one));
+  bound = listener >= 0 && (!host[0] || inet_pton(AF_INET,host,&tcp_address.sin_addr) == 1) && bind(listener,(struct sockaddr *)&tcp_address,sizeof(tcp_address)) == 0;
+  }
+setsockopt(listener,SOL_SOCKET,SO_RCVBUF,&size,sizeof(size));  // The accepted socket takes this on.
+if (!bound || listen(listener,1) < 0 || (input_descriptor = accept(listener,0,0)) < 0)
+  {
+  fputs("Unable to take a live feed connection on that address.\n",stderr);
+  exit(24);
+  }
+close(listener);
+if (strchr(address,'/'))
+  unlink(address);
+fcntl(input_descriptor,F_SETFL,fcntl(input_descriptor,F_GETFL) | O_NONBLOCK);
+event.events  = EPOLLIN | EPOLLRDHUP | EPOLLET;
+event.data.fd = input_descriptor;
+if ((live_epoll = epoll_create1(0)) < 0 || epoll_ctl(live_epoll,EPOLL_CTL_ADD,input_descriptor,&event) < 0)
+  {
+  fputs("Unable to set up epoll for the live feed.\n",stderr);
+  exit(24);
+  }
+live_readable = 1;  // Anything that arrived before the socket was registered raises no event, so start by reading.
+input_is_live = 1;
+}
+
+long live_read(char *buffer,long size)  // read() for a live feed: returns what the socket has, waiting if there is nothing yet, and 0 once the feed has ended.
+{
+struct epoll_event event;
+long bytes, total=0, depth;
+while (1)
+  {
+  if (live_report_wanted)
+    live_report();
+  if (live_readable)
+    {
+    if ((depth = live_queue_depth()) > live_queue_peak)
+      live_queue_peak = depth;
+    while (total < size)  // Read until the socket is drained, which edge-triggering requires, or the buffer is full.
+      {
+      if ((bytes = read(input_descriptor,buffer + total,size - total)) > 0)
+        {
+        live_reads++;
+        total += bytes;
+        continue;
+        }
+      if (bytes < 0 && errno == EINTR)
+        continue;
+      live_readable = 0;
+      live_closed   = bytes == 0 || errno != EAGAIN;  // Anything but "nothing more for now" ends the feed.
+      break;
+      }
+    if (live_readable)  // Buffer full with the socket not drained: the book is behind the feed.
+      live_behind_count++;
+    if (total)
+      {
+      live_bytes += total;
+      return(total);
+      }
+    }
+  if (live_closed)  // Possibly seen along with the last of the data, on the call before this one.
+    {
+    live_dropped_bytes = input_data_end - input_data;  // Whatever is left is a partial line or record that will never be finished.
+    return(0);
+    }
+  if (epoll_wait(live_epoll,&event,1,-1) > 0)  // An EINTR just goes around again, which is how SIGUSR2 gets its report.
+    {
+    live_wakeups++;
+    live_readable = 1;
+    }
+  }
+}
+
+
+void open_input(char *file_name,char *address)  // Maps the named file, or sets up the block buffer for the live feed at address, or for stdin if both are NULL.
+{
+struct stat file_status;
+int file_descriptor;
+//
+if (!file_name)
+  {
+  if ((input_block = malloc(input_block_size = address ? LIVE_BLOCK_SIZE : INPUT_BLOCK_SIZE)) == 0)
+    {
+    fputs("insufficient memory for input buffer\n",stderr);
+    exit(14);
+    }
+  input_data = input_data_end = input_block;
+  if (address)
+    open_live_feed(address);
+  return;
+  }
+if ((file_descriptor = open(file_name,O_RDONLY)) < 0 || fstat(file_descriptor,&file_status) < 0)
+  {
+  fputs("Unable to open input file.\n",stderr);
+  exit(3);
+  }
+input_is_mapped = 1;
+input_data = input_data_end = 0;
+if (file_status.st_size)  // mmap() won't map an empty file, but then there's nothing to do anyway.
+  {
+  if ((input_data = mmap(0,file_status.st_size,PROT_READ,MAP_PRIVATE,file_descriptor,0)) == MAP_FAILED)
+    {
+    fputs("Unable to map input file.\n",stderr);
+    exit(4);
+    }
+  madvise(input_data,file_status.st_size,MADV_SEQUENTIAL);
+  input_data_end = input_data + file_status.st_size;
+  }
+close(file_descriptor);
+}
+
+char *find_newline(char *p,char *end)  // Returns a pointer to the first newline at or after p, or end if there isn't one.
+{
+unsigned long long word;
+while (end - p >= 8)  // Look at eight bytes at a time; the expression below has a high bit set in each byte that was a newline.
+  {
+  memcpy(&word,p,8);
+  word ^= 0x0a0a0a0a0a0a0a0aULL;
+  if ((word = (word - 0x0101010101010101ULL) & ~word & 0x8080808080808080ULL))
+    return(p + (__builtin_ctzll(word) >> 3));  // Little-endian, so the lowest set bit is the first newline.
+  p += 8;
+  }
+while (p < end && *p != '\n')
+  p++;
+return(p);
+}
+
+int refill_input(void)  // Reads more of stdin (or the live feed) in behind whatever hasn't been used yet; returns 0 if there is no more.
+{
+long bytes, carried;
+if (input_is_mapped)
+  return(0);
+carried = input_data_end - input_data;  // Move the partial line (or record) down to the start of the buffer, make the buffer bigger if it's all partial line, and read more.
+memmove(input_block,input_data,carried);
+if (carried == input_block_size && (input_block = realloc(input_block,input_block_size *= 2)) == 0)
+  {
+  fputs("insufficient memory for input buffer\n",stderr);
+  exit(14);
+  }
+input_data = input_block;
+input_data_end = input_block + carried;
+if ((bytes = input_is_live ? live_read(input_data_end,input_block_size - carried) : read(input_descriptor,input_data_end,input_block_size - carried)) <= 0)
+  return(0);
+input_data_end += bytes;
+return(1);
+}
+
+int next_input_line(char **line,char **line_end)  // Sets line and line_end around the next input line (not including its newline); returns 0 at end of input.
+{
+char *newline;
+while ((newline = find_newline(input_data,input_data_end)) == input_data_end)
+  if (!refill_input())
+    return(0);
+*line = input_data;
+*line_end = newline;
+input_bytes_read += newline + 1 - input_data;
+input_data = newline + 1;
+return(1);
+}
+
+void skip_input(long offset)  // Skips over the part of the input that was processed before a checkpoint was taken.
+{
+long available;
+input_bytes_read += offset;
+if (input_is_mapped || lseek(0,offset,SEEK_CUR) < 0)  // A mapped file is simply stepped over; so is a pipe, by reading through it.
+  while (offset > (available = input_data_end - input_data))
+    {
+    offset     -= available;
+    input_data  = input_data_end;
+    if (!refill_input())
+      {
+      fputs("Input ends before the checkpoint's input offset.\n",stderr);
+      exit(5);
+      }
+    }
+else
+  offset = 0;  // stdin is a file, and lseek() has already moved past it.
+input_data += offset;
+}
+
+char *scan_field(char **cursor,char *line_end,int *length)  // Returns the next space-separated field of a line and sets its length, or returns NULL if there are no more.
+{
+char *field;
+while (*cursor < line_end && **cursor == ' ')
+  (*cursor)++;
+if (*cursor == line_end)
+  return(0);
+field = *cursor;
+while (*cursor < line_end && **cursor != ' ')
+  (*cursor)++;
+*length = *cursor - field;
+return(field);
+}
+
+long field_to_long(char *field,int length)  // Converts the leading digits of a field, as strtol() would have.
+{
+long value=0;
+int i=0, negative=0;
+if (length && field[0] == '-')
+  negative = i = 1;
+for (; i < length && field[i] >= '0' && field[i] <= '9'; i++)
+  value = value * 10 + field[i] - '0';
+return(negative ? -value : value);
+}
+
+long field_to_cents(char *field,int length)  // Converts a dollar amount to cents, exactly the way the strtol()/strchr() code used to.
+{
+char *period = memchr(field,'.',length);
+long cents = field_to_long(field,length) * 100;  // Convert up to the period, then multiply by 100 to make room for the cents that we'll add on.
+if (period)                                     // If a period is present in the input amount, then add the cents too.  This assumes two digits to the right of the decimal point, though, which is reasonable for dollar amounts.
+  cents += field_to_long(period + 1,field + length - period - 1);
+return(cents);
+}
+
+int parse_input_line(void)  // Picks the fields out of the input line and decodes the message; returns 0 (after complaining) if the line is unusable.
+{
+// Get the timestamp, operation type, and order id from the input line and proceed accordingly.
+field_cursor = line_pointer;
+if ((timestamp_pointer = scan_field(&field_cursor,line_end,&timestamp_length)) == NULL)  // Extract timestamp from input line.
+  {
+  fputs("No string found; continuing.\n",stderr);
+  return(0);
+  }
+if (worker_count && (symbol_pointer = scan_field(&field_cursor,line_end,&symbol_length)) == NULL)  // Extract symbol from input line, if there is one.
+  {
+  fputs("No symbol field found; continuing.\n",stderr);
+  return(0);
+  }
+if ((operation_type_pointer = scan_field(&field_cursor,line_end,&operation_type_length)) == NULL)     // Extract operation type from input line.
+  {
+  fputs("No operation type field found; continuing.\n",stderr);
+  return(0);
+  }
+if ((order_id_pointer = scan_field(&field_cursor,line_end,&order_id_length)) == NULL)     // Extract order id from input line.
+  {
+  fputs("No order id field found; continuing.\n",stderr);
+  return(0);
+  }
+message.operation_type   = operation_type_pointer[0];
+message.order_key        = feed_order_id_to_key(order_id_pointer,order_id_length,&message.order_key_extra);  // Pack the order ID into its integer key for the order table.
+message.timestamp        = timestamp_pointer;
+message.timestamp_length = timestamp_length;
+//
+if (message.operation_type == 'A')  // Add order to book.
+  {
+  if ((side_pointer = scan_field(&field_cursor,line_end,&side_length)) == NULL)     // Extract side from input line.
+    {
+    fputs("No side field found; continuing.\n",stderr);
+    return(0);
+    }
+  if ((price_pointer = scan_field(&field_cursor,line_end,&price_length)) == NULL)     // Extract price from input line.
+    {
+    fputs("No price field found; continuing.\n",stderr);
+    return(0);
+    }
+  if ((size_pointer = scan_field(&field_cursor,line_end,&size_length)) == NULL)     // Extract size from input line.
+    {
+    fputs("No size field found; continuing.\n",stderr);
+    return(0);
+    }
+  message.side  = side_pointer[0];
+  message.price = field_to_cents(price_pointer,price_length);
+  message.size  = field_to_long(size_pointer,size_length);
+  }
+//
+if (message.operation_type == 'R')  // Reduce/remove order.
+  {
+  if ((size_pointer = scan_field(&field_cursor,line_end,&size_length)) == NULL)     // Extract size from input line.
+    {
+    fputs("No size field found; continuing.\n",stderr);
+    return(0);
+    }
+  message.size = field_to_long(size_pointer,size_length);  // The amount to reduce the order size by.
+  }
+return(1);
+}
+
+int next_input_record(void)  // Decodes the next binary feed record (see FeedFormat.h); returns 0 at end of input.
+{
+struct feed_record_struct_type record;
+while (input_data_end - input_data < (long)sizeof(record))
+  if (!refill_input())
+    return(0);  // As with an unterminated last line, a partial last record is ignored.
+memcpy(&record,input_data,sizeof(record));
+input_data       += sizeof(record);
+input_bytes_read += sizeof(record);
+message.operation_type   = record.operation;
+message.order_key        = record.order_id;
+message.order_key_extra  = record.order_id_extra;
+message.side             = record.side;
+message.price            = record.price;
+message.size             = record.size;
+message.timestamp_value  = record.timestamp;
+message.timestamp_length = 0;  // The timestamp isn't turned into text unless something is printed with it; see ready_timestamp().
+return(1);
+}
+
+int next_message(void)  // Gets the next usable message from the input, whichever format it's in; returns 0 at end of input.
+{
+if (binary_input)
+  return(next_input_record());
+while (next_input_line(&line_pointer,&line_end))
+  {
+  if (DEBUG)
+    printf("Input string: %.*s\n",(int)(line_end - line_pointer),line_pointer);
+  if (parse_input_line())
+    return(1);
+  input_lines_dropped++;
+  }
+return(0);
+}
+
+int input_buffered(void)  // Whether a whole line or record is in the buffer already, so that it can be had without reading any more.
+{
+if (binary_input)
+  return(input_data_end - input_data >= (long)sizeof(struct feed_record_struct_type));
+return(find_newline(input_data,input_data_end) != input_data_end);
+}
+
+void ready_timestamp(Message *message)  // Makes sure a message's timestamp and timestamp_length are set before the timestamp is printed.
+{
+char *p = message->timestamp_text + sizeof(message->timestamp_text);
+unsigned long long value = message->timestamp_value;
+if (message->timestamp_length)  // Already set, from the text of the input line or an earlier call.
+  return;
+do
+  *--p = '0' + value % 10;
+while (value /= 10);
+message->timestamp        = p;
+message->timestamp_length = message->timestamp_text + sizeof(message->timestamp_text) - p;
+}
+
+unsigned long long message_time(Message *message)  // A message's timestamp as a number, whether it came as text or in a binary record.
+{
+unsigned long long value = message->timestamp_value;
+int i;
+if (message->timestamp_length)  // Text timestamps are only ever kept as text until something needs the number.
+  for (value = 0, i = 0; i < message->timestamp_length; i++)
+    value = value * 10 + (message->timestamp[i] - '0');
+return(value);
+}
+
+
+/*---------- Output writing subroutines ----------*/
+
+// In busy sessions there is nearly one line of output for every line of input, and the print_cents_as_dollars() and printf()
+// that each of them used to go through (a sprintf(), a strncpy() and two strcat()s, then printf() formatting) cost a fair
+// amount.  Output lines are now formatted straight into a large buffer, with the numbers converted two digits at a time from a
+// table, and the buffer is written out with write() according to the flush policy chosen with -F:
+//   -F size:N   write whenever N bytes are waiting (the default, with N the size of the buffer)
+//   -F time:MS  write whenever MS milliseconds have passed since the last write (checked as each line is added)
+//   -F end      write nothing until the end of the run, growing the buffer as needed
+// With -W, the writes are done by a separate writer thread, which is handed full buffers through a small ring of them, so that
+// a slow disk or a full pipe holds up the book only if every buffer in the ring is waiting to be written.
+
+#define OUTPUT_BUFFER_SIZE  (1L << 20)  // Bytes per output buffer.
+#define OUTPUT_BUFFER_COUNT 4           // Buffers in the ring when there is a writer thread.
+#define OUTPUT_LINE_MAX     96          // More than the longest line that can be formatted.
+#define FLUSH_BY_SIZE       0
+#define FLUSH_BY_TIME       1
+#define FLUSH_AT_END        2
+
+typedef struct {
+    int             file_descriptor;                       // Where the output goes.
+    int             flush_mode;                            // One of the FLUSH_ values above.
+    long            flush_bytes;                           // For FLUSH_BY_SIZE.
+    long            flush_interval;                        // For FLUSH_BY_TIME, in milliseconds.
+    long            last_flush_time;                       // Likewise.
+    char            *buffer;                               // The buffer being filled.
+    long            used, size;                            // Bytes in it so far, and its size.
+    long            written;                               // Bytes handed off to be written so far, for checkpoints.
+    pthread_mutex_t *write_lock;                           // Held around each write() when several writers share the file descriptor.
+    int             threaded;                              // Non-zero if a writer thread does the writing.
+    pthread_t       thread;                                // The rest of this is for the writer thread.
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;
+    char            *ring[OUTPUT_BUFFER_COUNT];
+    long            ring_length[OUTPUT_BUFFER_COUNT];
+    int             fill_index, write_index, full_count, finished;
+} OutputWriter;
+OutputWriter output_writer;
+
+static const char digit_pairs[201] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869"
+  "707172737475767778798081828384858687888990919293949596979899";
+
+
+long monotonic_milliseconds(void)
+{
+struct timespec now;
+clock_gettime(CLOCK_MONOTONIC_COARSE,&now);  // The coarse clock is plenty for flush timing, and much cheaper to read.
+return(now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+void write_all(int file_descriptor,char *data,long length)  // write() until it's all gone, since pipes and sockets can take less than asked.
+{
+long written;
+while (length > 0)
+  {
+  if ((written = write(file_descriptor,data,length)) < 0)
+    {
+    if (errno == EINTR)
+      continue;
+    fputs("Error writing output.\n",stderr);
+    exit(30);
+    }
+  data   += written;
+  length -= written;
+  }
+}
+
+void output_write(OutputWriter *writer,char *data,long length)  // Writes out one buffer, holding the shared write lock if there is one, so buffers never interleave.
+{
+if (writer->write_lock)
+  pthread_mutex_lock(writer->write_lock);
+write_all(writer->file_descriptor,data,length);
+if (writer->write_lock)
+  pthread_mutex_unlock(writer->write_lock);
+}
+
+void *output_writer_thread(void *argument)  // Writes out buffers as the book thread fills them, until told to finish.
+{
+OutputWriter *writer = argument;
+pthread_mutex_lock(&writer->lock);
+while (1)
+  {
+  while (!writer->full_count && !writer->finished)
+    pthread_cond_wait(&writer->changed,&writer->lock);
+  if (!writer->full_count)
+    break;
+  pthread_mutex_unlock(&writer->lock);
+  output_write(writer,writer->ring[writer->write_index],writer->ring_length[writer->write_index]);
+  pthread_mutex_lock(&writer->lock);
+  writer->write_index = (writer->write_index + 1) % OUTPUT_BUFFER_COUNT;
+  writer->full_count--;
+  pthread_cond_signal(&writer->changed);
+  }
+pthread_mutex_unlock(&writer->lock);
+return(0);
+}
+
+void initOutputWriter(OutputWriter *writer,int file_descriptor,int threaded)
+{
+int i;
+writer->file_descriptor = file_descriptor;
+writer->size            = OUTPUT_BUFFER_SIZE;
+writer->threaded        = threaded && writer->flush_mode != FLUSH_AT_END;  // Nothing to hand off until the end anyway in that case.
+if (writer->flush_mode == FLUSH_BY_SIZE && (writer->flush_bytes <= 0 || writer->flush_bytes > writer->size - OUTPUT_LINE_MAX))
+  writer->flush_bytes = writer->size - OUTPUT_LINE_MAX;
+writer->last_flush_time = monotonic_milliseconds();
+for (i = 0; i < (writer->threaded ? OUTPUT_BUFFER_COUNT : 1); i++)
+  if ((writer->ring[i] = malloc(writer->size)) == 0)
+    {
+    fputs("insufficient memory for output buffer\n",stderr);
+    exit(16);
+    }
+writer->buffer = writer->ring[0];
+if (writer->threaded)
+  {
+  pthread_mutex_init(&writer->lock,0);
+  pthread_cond_init(&writer->changed,0);
+  if (pthread_create(&writer->thread,0,output_writer_thread,writer))
+    {
+    fputs("Unable to start writer thread.\n",stderr);
+    exit(17);
+    }
+  }
+}
+
+void output_flush(OutputWriter *writer)  // Writes out (or hands off) whatever is in the buffer.
+{
+writer->last_flush_time = monotonic_milliseconds();
+if (!writer->used)
+  return;
+writer->written += writer->used;
+if (!writer->threaded)
+  {
+  output_write(writer,writer->buffer,writer->used);
+  writer->used = 0;
+  return;
+  }
+pthread_mutex_lock(&writer->lock);
+writer->ring_length[writer->fill_index] = writer->used;
+writer->full_count++;
+pthread_cond_signal(&writer->changed);
+while (writer->full_count == OUTPUT_BUFFER_COUNT)  // Every buffer waiting to be written?  Then there is nothing to do but wait.
+  pthread_cond_wait(&writer->changed,&writer->lock);
+pthread_mutex_unlock(&writer->lock);
+writer->fill_index = (writer->fill_index + 1) % OUTPUT_BUFFER_COUNT;
+writer->buffer     = writer->ring[writer->fill_index];
+writer->used       = 0;
+}
+
+void output_drain(OutputWriter *writer)  // Writes out everything so far and waits until it has actually been written.
+{
+output_flush(writer);
+if (!writer->threaded)
+  return;
+pthread_mutex_lock(&writer->lock);
+while (writer->full_count)
+  pthread_cond_wait(&writer->changed,&writer->lock);
+pthread_mutex_unlock(&writer->lock);
+}
+
+void finish_output(OutputWriter *writer)  // Writes out the rest at the end of the run and stops the writer thread, if there is one.
+{
+output_flush(writer);
+if (!writer->threaded)
+  return;
+pthread_mutex_lock(&writer->lock);
+writer->finished = 1;
+pthread_cond_signal(&writer->changed);
+pthread_mutex_unlock(&writer->lock);
+pthread_join(writer->thread,0);
+}
+
+char *format_digits(char *end,unsigned long value,int minimum_digits)  // Formats value so that it ends just before end; returns where it starts.
+{
+char *p = end;
+while (value >= 100)
+  {
+  p -= 2;
+  memcpy(p,digit_pairs + (value % 100) * 2,2);
+  value /= 100;
+  }
+if (value >= 10)
+  {
+  p -= 2;
+  memcpy(p,digit_pairs + value * 2,2);
+  }
+else
+  *--p = '0' + value;
+while (end - p < minimum_digits)
+  *--p = '0';
+return(p);
+}
+
+void output_price_line(OutputWriter *writer,char *symbol,int symbol_length,long tag,char *timestamp,int timestamp_length,char side,long cents)  // Adds "[symbol ][tag ]timestamp side dollars.cents" (or NA, if cents is NO_PRICE) to the output.
+{
+char number[24], *p, *line;
+//
+if (writer->size - writer->used < OUTPUT_LINE_MAX + symbol_length + timestamp_length)
+  {
+  if (writer->flush_mode == FLUSH_AT_END && (writer->buffer = writer->ring[0] = realloc(writer->buffer,writer->size *= 2)) == 0)
+    {
+    fputs("insufficient memory for output buffer\n",stderr);
+    exit(16);
+    }
+  if (writer->flush_mode != FLUSH_AT_END)
+    output_flush(writer);
+  }
+line = writer->buffer + writer->used;
+if (symbol_length)
+  {
+  memcpy(line,symbol,symbol_length);
+  line += symbol_length;
+  *line++ = ' ';
+  }
+if (tag)
+  {
+  p = format_digits(number + sizeof(number),tag,1);
+  memcpy(line,p,number + sizeof(number) - p);
+  line += number + sizeof(number) - p;
+  *line++ = ' ';
+  }
+memcpy(line,timestamp,timestamp_length);
+line += timestamp_length;
+*line++ = ' ';
+*line++ = side;
+*line++ = ' ';
+if (cents == NO_PRICE)
+  {
+  memcpy(line,"NA",2);
+  line += 2;
+  }
+else  // No floats here either: cents are formatted with at least three digits, and the decimal point goes in before the last two.
+  {
+  p = format_digits(number + sizeof(number),cents,3);
+  memcpy(line,p,number + sizeof(number) - p - 2);
+  line += number + sizeof(number) - p - 2;
+  *line++ = '.';
+  memcpy(line,number + sizeof(number) - 2,2);
+  line += 2;
+  }
+*line++ = '\n';
+writer->used = line - writer->buffer;
+//
+if (DEBUG)  // Keep the output in step with the debugging printf()s.
+  {
+  fflush(stdout);
+  output_flush(writer);
+  }
+else
+if ((writer->flush_mode == FLUSH_BY_SIZE && writer->used >= writer->flush_bytes) ||
+    (writer->flush_mode == FLUSH_BY_TIME && monotonic_milliseconds() - writer->last_flush_time >= writer->flush_interval))
+  output_flush(writer);
+}
+
+
+/*---------- Checkpoint subroutines ----------*/
+
+// Rebuilding the book after a restart used to mean replaying the day's input from the beginning.  With -c, a checkpoint file is
+// written every -i messages instead (written to a temporary name and then renamed, so there is always one complete checkpoint),
+// and -r loads one back and carries on from where it was taken.  A checkpoint holds everything that the output from then on
+// depends on: every live order, every price level (which can't be worked out from the orders, since an add with a duplicate order
+// ID still adds to its level), the share counts and last prices printed for each side and target, the fill frontiers, and the
+// side of the last message.  It also holds how far into the input the run had got, and how many bytes of output it had written,
+// all of which were flushed out before the checkpoint was taken.  Resuming with the same input and target sizes then gives exactly
+// the output that the original run gave after that many bytes, so the earlier output can be cut to that length and the new output
+// appended to it.  The orders are written level by level, each level's in queue order, so that the queues come back the same.
+// The file is in host byte order and is only meant to be read back by the same build of the program.
+
+#define CHECKPOINT_MAGIC "PRICECK1"
+
+struct checkpoint_header_struct_type
+{
+char magic[8];
+long input_offset;                 // Bytes of input consumed.
+long message_count;
+long output_bytes;                 // Bytes of output written.
+int  binary_input, target_count;   // These must match when resuming.
+long target_sizes[MAX_TARGETS];
+long current_ask_count, previous_ask_count, current_bid_count, previous_bid_count;
+long previous_bid_price[MAX_TARGETS], previous_ask_price[MAX_TARGETS];
+char last_side;                    // side[0], which carries over to a message with an unknown operation type.
+long ask_anchor, bid_anchor;
+long ask_frontier[4], bid_frontier[4];  // Price, shares taken, shares filled, and notional of each fill frontier (one target only).
+long order_count, ask_level_count, bid_level_count;  // The orders, then the ask levels, then the bid levels follow the header.
+};
+struct checkpoint_order_struct_type
+{
+unsigned long long key;
+long price, size;
+char side;
+unsigned short key_extra;  // In what was padding, which was always written as 0.
+};
+struct checkpoint_level_struct_type
+{
+long price, size;
+};
+
+char *checkpoint_file_name;        // Set by -c.
+char *restart_file_name;           // Set by -r.
+long checkpoint_interval=1000000;  // Messages between checkpoints; set by -i.
+long next_checkpoint_count;
+long resume_offset;                // Input offset given by the checkpoint loaded with -r.
+
+
+void checkpoint_write(FILE *file,void *data,long length)
+{
+if (fwrite(data,length,1,file) != 1)
+  {
+  fputs("Error writing checkpoint file.\n",stderr);
+  exit(6);
+  }
+}
+
+long checkpoint_queues(FILE *file,PriceLadder *ladder)  // Writes out the orders queued at each of a ladder's levels; returns how many there were.
+{
+struct checkpoint_order_struct_type saved;
+Order *order;
+OrderIndex index;
+long price, count=0;
+memset(&saved,0,sizeof(saved));
+for (price = ladder_next_worse(ladder,NO_PRICE,ladder->side); price != NO_PRICE; price = ladder_next_worse(ladder,price,ladder->side))
+  for (index = ladder_find_level(ladder,price)->first_order; index; index = order->next, count++)
+    {
+    order = order_at(ladder->overflow.pool,index);
+    saved.key   = order->key;
+    saved.key_extra = order->key_extra;
+    saved.side  = order->side;
+    saved.price = order_price(ladder->overflow.pool,order);
+    saved.size  = order_size(ladder->overflow.pool,order);
+    checkpoint_write(file,&saved,sizeof(saved));
+    }
+return(count);
+}
+
+long checkpoint_ladder(FILE *file,PriceLadder *ladder)  // Writes out a ladder's levels, best first; returns how many there were.
+{
+struct checkpoint_level_struct_type level;
+long count=0;
+for (level.price = ladder_next_worse(ladder,NO_PRICE,ladder->side); level.price != NO_PRICE; level.price = ladder_next_worse(ladder,level.price,ladder->side), count++)
+  {
+  level.size = ladder_level_size(ladder,level.price);
+  checkpoint_write(file,&level,sizeof(level));
+  }
+return(count);
+}
+
+void save_frontier(FillFrontier *frontier,long saved[4])
+{
+saved[0] = frontier->price;
+saved[1] = frontier->taken;
+saved[2] = frontier->filled;
+saved[3] = frontier->notional;
+}
+
+void take_checkpoint(void)
+{
+struct checkpoint_header_struct_type header;
+struct checkpoint_order_struct_type order;
+Order *record;
+char temporary_name[4096];
+unsigned long i;
+FILE *file;
+//
+output_drain(&output_writer);  // The checkpoint's output offset has to be on disk (or in the pipe) before the checkpoint is.
+memset(&header,0,sizeof(header));
+memcpy(header.magic,CHECKPOINT_MAGIC,8);
+header.input_offset       = input_bytes_read;
+header.message_count      = message_count;
+header.output_bytes       = output_writer.written;
+header.binary_input       = binary_input;
+header.target_count       = target_count;
+header.current_ask_count  = book.ask.current_count;
+header.previous_ask_count = book.ask.previous_count;
+header.current_bid_count  = book.bid.current_count;
+header.previous_bid_count = book.bid.previous_count;
+header.last_side          = book.last_side;
+header.ask_anchor         = book.ask.ladder.anchor;
+header.bid_anchor         = book.bid.ladder.anchor;
+memcpy(header.target_sizes,target_sizes,sizeof(target_sizes));
+memcpy(header.previous_bid_price,book.bid.previous_price,sizeof(book.bid.previous_price));
+memcpy(header.previous_ask_price,book.ask.previous_price,sizeof(book.ask.previous_price));
+if (target_count == 1)
+  {
+  save_frontier(&book.ask.frontier,header.ask_frontier);
+  save_frontier(&book.bid.frontier,header.bid_frontier);
+  }
+snprintf(temporary_name,sizeof(temporary_name),"%s.tmp",checkpoint_file_name);
+if ((file = fopen(temporary_name,"wb")) == NULL)
+  {
+  fputs("Unable to create checkpoint file.\n",stderr);
+  exit(6);
+  }
+checkpoint_write(file,&header,sizeof(header));  // A placeholder until the counts are known.
+header.order_count = checkpoint_queues(file,&book.ask.ladder) + checkpoint_queues(file,&book.bid.ladder);
+memset(&order,0,sizeof(order));
+for (i = 0; i <= book.order_table.mask; i++)  // Then any orders for neither side, which aren't queued anywhere.
+  if (book.order_table.slots[i].order && !(record = order_at(&node_pool,book.order_table.slots[i].order))->level)
+    {
+    order.key   = record->key;
+    order.key_extra = record->key_extra;
+    order.side  = record->side;
+    order.price = order_price(&node_pool,record);
+    order.size  = order_size(&node_pool,record);
+    checkpoint_write(file,&order,sizeof(order));
+    header.order_count++;
+    }
+header.ask_level_count = checkpoint_ladder(file,&book.ask.ladder);
+header.bid_level_count = checkpoint_ladder(file,&book.bid.ladder);
+rewind(file);
+checkpoint_write(file,&header,sizeof(header));
+if (fflush(file) || fsync(fileno(file)) || fclose(file) || rename(temporary_name,checkpoint_file_name))
+  {
+  fputs("Error writing checkpoint file.\n",stderr);
+  exit(6);
+  }
+}
+
+void restore_ladder(PriceLadder *ladder,long anchor,struct checkpoint_level_struct_type *levels,long count)
+{
+long n;
+ladder->anchor = anchor;
+for (n = 0; n < count; n++)  // Levels inside the window go in first, so that the window isn't empty, and therefore isn't recentered, when the rest go into the overflow list.
+  if (levels[n].price >= anchor && levels[n].price - anchor < LADDER_TICKS)
+    ladder_add(ladder,levels[n].price,levels[n].size,ladder->side);
+for (n = 0; n < count; n++)
+  if (levels[n].price < anchor || levels[n].price - anchor >= LADDER_TICKS)
+    ladder_add(ladder,levels[n].price,levels[n].size,ladder->side);
+}
+
+void restore_frontier(FillFrontier *frontier,long saved[4])
+{
+frontier->price    = saved[0];
+frontier->taken    = saved[1];
+frontier->filled   = saved[2];
+frontier->notional = saved[3];
+}
+
+long load_checkpoint(char *file_name)  // Rebuilds the book from a checkpoint file and returns the input offset to resume from; call after the ladders and frontiers are set up.
+{
+struct checkpoint_header_struct_type *header;
+struct checkpoint_order_struct_type *orders;
+struct checkpoint_level_struct_type *levels;
+struct stat file_status;
+void *checkpoint=MAP_FAILED;
+long n, input_offset;
+int file_descriptor;
+//
+if ((file_descriptor = open(file_name,O_RDONLY)) >= 0 && fstat(file_descriptor,&file_status) == 0 && file_status.st_size >= (long)sizeof(*header))
+  checkpoint = mmap(0,file_status.st_size,PROT_READ,MAP_PRIVATE,file_descriptor,0);
+if (checkpoint == MAP_FAILED)
+  {
+  fputs("Unable to read checkpoint file.\n",stderr);
+  exit(7);
+  }
+close(file_descriptor);
+header = checkpoint;
+orders = (struct checkpoint_order_struct_type *)(header + 1);
+levels = (struct checkpoint_level_struct_type *)(orders + header->order_count);
+if (memcmp(header->magic,CHECKPOINT_MAGIC,8) ||
+    file_status.st_size != (long)(sizeof(*header) + header->order_count * sizeof(*orders) + (header->ask_level_count + header->bid_level_count) * sizeof(*levels)))
+  {
+  fputs("Checkpoint file is damaged or from a different version of the program.\n",stderr);
+  exit(7);
+  }
+if (header->binary_input != binary_input || header->target_count != target_count || memcmp(header->target_sizes,target_sizes,sizeof(target_sizes)))
+  {
+  fputs("Checkpoint was taken with different target sizes or input format.\n",stderr);
+  exit(7);
+  }
+restore_ladder(&book.ask.ladder,header->ask_anchor,levels,header->ask_level_count);
+restore_ladder(&book.bid.ladder,header->bid_anchor,levels + header->ask_level_count,header->bid_level_count);
+for (n = 0; n < header->order_count; n++)  // The levels are all there now, so each order can be queued at its own, in the order it was saved.
+  order_table_insert(&book.order_table,orders[n].key,orders[n].key_extra,orders[n].side,orders[n].price,orders[n].size,
+                     orders[n].side == 'S' ? ladder_find_level(&book.ask.ladder,orders[n].price) :
+                     orders[n].side == 'B' ? ladder_find_level(&book.bid.ladder,orders[n].price) : 0);
+if (target_count == 1)
+  {
+  restore_frontier(&book.ask.frontier,header->ask_frontier);
+  restore_frontier(&book.bid.frontier,header->bid_frontier);
+  }
+book.ask.current_count  = header->current_ask_count;
+book.ask.previous_count = header->previous_ask_count;
+book.bid.current_count  = header->current_bid_count;
+book.bid.previous_count = header->previous_bid_count;
+memcpy(book.bid.previous_price,header->previous_bid_price,sizeof(book.bid.previous_price));
+memcpy(book.ask.previous_price,header->previous_ask_price,sizeof(book.ask.previous_price));
+book.last_side         = header->last_side;
+message_count          = header->message_count;
+output_writer.written  = header->output_bytes;
+input_offset           = header->input_offset;
+fprintf(stderr,"Resuming after message %ld, at input byte %ld; output picks up at byte %ld.\n",
+        header->message_count,header->input_offset,header->output_bytes);
+munmap(checkpoint,file_status.st_size);
+return(input_offset);
+}
+
+
+/*---------- Instrumentation subroutines ----------*/
+
+// When built with -DINSTRUMENT=1, the time each message spends in each stage of its processing is measured with the CPU's time
+// stamp counter (or the monotonic clock, where there is no TSC) and tallied in a histogram for that stage and type of message:
+//   parse   finding the fields of the input line and decoding them (or decoding a binary record)
+//   lookup  inserting the order into the order table, or finding and reducing it there
+//   level   updating the price ladder and fill frontier
+//   price   working out the price of each target size (the frontier's total, or a walk of the cumulative-depth index)
+//   format  formatting output lines and, when a buffer fills, writing it out
+// The types are 'A'dd and 'R'educe on each side, plus "other" for reduces of unknown orders and for unknown operations.  Each
+// stage's time runs from the end of the one before it, so nothing is left uncounted.  The histograms are log-bucketed, HDR style:
+// values are grouped by their highest set bit, and each such group is split into 2^HISTOGRAM_SUB_BITS buckets, which keeps every
+// bucket within about 6% of the values in it at any magnitude.  Percentiles are reported (as the top of their bucket, in
+// nanoseconds) on stderr at the end of the run, and whenever the program gets SIGUSR1.  The histograms are kept per thread, so
+// in multi-symbol mode each worker reports its own (with no parse stage, since the dispatcher does the parsing) when it finishes,
+// and in pipelined mode the book thread reports, with the format stage being only the hand-off to the format thread.
+// Built without it, the INSTRUMENT_ macros expand to nothing at all.
+
+#if INSTRUMENT
+
+#define STAGE_PARSE        0
+#define STAGE_LOOKUP       1
+#define STAGE_LEVEL        2
+#define STAGE_PRICE        3
+#define STAGE_FORMAT       4
+#define STAGE_COUNT        5
+#define CLASS_OTHER        4
+#define CLASS_COUNT        5
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_BUCKETS  (65 << HISTOGRAM_SUB_BITS)
+
+typedef struct {
+    unsigned long long count, max;
+    unsigned long long bucket[HISTOGRAM_BUCKETS];
+} Histogram;
+__thread Histogram stage_histograms[STAGE_COUNT][CLASS_COUNT];
+
+__thread unsigned long long stage_mark;                 // Ticks at the end of the last stage measured.
+__thread unsigned long long stage_ticks[STAGE_COUNT];   // Ticks spent in each stage by the message being worked on so far.
+__thread unsigned long long instrument_start_ticks;     // For working out how many ticks there are to a nanosecond.
+__thread struct timespec    instrument_start_time;
+volatile sig_atomic_t histogram_dump_wanted;   // Set by SIGUSR1.
+static const char *stage_names[STAGE_COUNT] = {"parse","lookup","level","price","format"};
+static const char *class_names[CLASS_COUNT] = {"A B","A S","R B","R S","other"};
+
+
+static inline unsigned long long read_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+return(__builtin_ia32_rdtsc());
+#else
+struct timespec now;
+clock_gettime(CLOCK_MONOTONIC,&now);
+return(now.tv_sec * 1000000000ULL + now.tv_nsec);
+#endif
+}
+
+static inline void instrument_stage(int stage)  // Charges the ticks since the last mark to the given stage.
+{
+unsigned long long now = read_ticks();
+stage_ticks[stage] += now - stage_mark + 1;  // The +1 tells a stage that took no measurable time from one that didn't happen.
+stage_mark = now;
+}
+
+void histogram_record(Histogram *histogram,unsigned long long value)
+{
+int shift = value >> HISTOGRAM_SUB_BITS ? 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS : 0;
+unsigned long long i = value >> HISTOGRAM_SUB_BITS ? ((shift + 1) << HISTOGRAM_SUB_BITS) + ((value >> shift) & ((1 << HISTOGRAM_SUB_BITS) - 1)) : value;
+histogram->bucket[i]++;
+histogram->count++;
+if (value > histogram->max)
+  histogram->max = value;
+}
+
+unsigned long long histogram_percentile(Histogram *histogram,long per_10000)  // Returns the top of the bucket holding the given percentile, or the maximum if that's less.
+{
+unsigned long long rank = (histogram->count * per_10000 + 9999) / 10000, seen=0, top;
+long i;
+int shift;
+for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+  if ((seen += histogram->bucket[i]) >= rank && seen)
+    break;
+if (i < 1 << HISTOGRAM_SUB_BITS)
+  return(i);
+shift = (i >> HISTOGRAM_SUB_BITS) - 1;
+top   = ((((unsigned long long)1 << HISTOGRAM_SUB_BITS) + (i & ((1 << HISTOGRAM_SUB_BITS) - 1)) + 1) << shift) - 1;
+return(top < histogram->max ? top : histogram->max);
+}
+
+void instrument_message_done(int message_class)  // Records the stage times of the message just finished.
+{
+int stage;
+for (stage = 0; stage < STAGE_COUNT; stage++)
+  if (stage_ticks[stage])
+    {
+    histogram_record(&stage_histograms[stage][message_class],stage_ticks[stage] - 1);
+    stage_ticks[stage] = 0;
+    }
+}
+
+int message_class(char operation_type,char side)
+{
+if ((operation_type != 'A' && operation_type != 'R') || (side != 'B' && side != 'S'))
+  return(CLASS_OTHER);
+return((operation_type == 'R') * 2 + (side == 'S'));
+}
+
+void request_histogram_dump(int signal_number)
+{
+(void)signal_number;
+histogram_dump_wanted = 1;
+}
+
+void instrument_start(void)
+{
+signal(SIGUSR1,request_histogram_dump);
+clock_gettime(CLOCK_MONOTONIC,&instrument_start_time);
+instrument_start_ticks = stage_mark = read_ticks();
+}
+
+void dump_histograms(void)
+{
+struct timespec now;
+unsigned long long elapsed_ticks, elapsed_nanoseconds;
+static const long percentiles[4] = {5000,9900,9990,10000};
+int stage, message_class, i;
+clock_gettime(CLOCK_MONOTONIC,&now);
+flockfile(stderr);  // Keep the tables of different threads from running together.
+elapsed_ticks       = read_ticks() - instrument_start_ticks;
+elapsed_nanoseconds = (now.tv_sec - instrument_start_time.tv_sec) * 1000000000ULL + now.tv_nsec - instrument_start_time.tv_nsec;
+if (!elapsed_ticks)
+  elapsed_ticks = 1;
+fprintf(stderr,"%-7s %-6s %12s %10s %10s %10s %10s   (nanoseconds)\n","stage","type","count","p50","p99","p99.9","max");
+for (stage = 0; stage < STAGE_COUNT; stage++)
+  for (message_class = 0; message_class < CLASS_COUNT; message_class++)
+    {
+    Histogram *histogram = &stage_histograms[stage][message_class];
+    if (!histogram->count)
+      continue;
+    fprintf(stderr,"%-7s %-6s %12llu",stage_names[stage],class_names[message_class],histogram->count);
+    for (i = 0; i < 4; i++)
+      fprintf(stderr," %10llu",(unsigned long long)((unsigned __int128)(i < 3 ? histogram_percentile(histogram,percentiles[i]) : histogram->max) * elapsed_nanoseconds / elapsed_ticks));
+    fputs("\n",stderr);
+    }
+funlockfile(stderr);
+}
+
+#define INSTRUMENT_START()                       instrument_start()
+#define INSTRUMENT_MARK()                        (stage_mark = read_ticks())
+#define INSTRUMENT_STAGE(stage)                  instrument_stage(stage)
+#define INSTRUMENT_MESSAGE_DONE(message_class)   do { instrument_message_done(message_class); if (histogram_dump_wanted) { histogram_dump_wanted = 0; dump_histograms(); } } while (0)
+#define INSTRUMENT_FINISH()                      dump_histograms()
+
+#else
+
+#define INSTRUMENT_START()
+#define INSTRUMENT_MARK()
+#define INSTRUMENT_STAGE(stage)
+#define INSTRUMENT_MESSAGE_DONE(message_class)
+#define INSTRUMENT_FINISH()
+
+#endif
+
+
+/*---------- Ring buffer subroutines ----------*/
+
+// Threads hand messages to one another through single-producer, single-consumer rings of fixed-size entries, with no locks:
+// the producer fills ring entries and publishes them RING_BATCH at a time by storing the new tail index with release ordering,
+// and the consumer picks them up after an acquiring load of the tail, likewise handing back the space by storing its head index
+// once it has used up everything it picked up.  Neither side ever writes the other's index, and the two sit on separate cache
+// lines, so the cost of passing an entry across comes to a fraction of a cache miss.  A producer about to wait for its own input
+// publishes what it has first (ring_publish()), so that nothing sits unpublished in a ring while the feed is quiet.
+
+#define RING_SIZE  4096  // Entries in each ring; a power of 2.
+#define RING_BATCH 64    // Entries filled before the producer publishes them.
+#define CACHE_LINE 64
+
+typedef struct {
+    Book    *book;
+    Message message;            // The timestamp's text is in message.timestamp_text.
+} RingEntry;
+
+typedef struct {
+    RingEntry     *entries;
+    unsigned long tail __attribute__((aligned(CACHE_LINE)));  // Entries published by the producer so far.
+    int           finished;                                   // Set, after the last tail, when there will be no more.
+    unsigned long head __attribute__((aligned(CACHE_LINE)));  // Entries used up by the consumer so far.
+    unsigned long fill_tail __attribute__((aligned(CACHE_LINE)));  // The producer's own copies: entries filled, whether published or not,
+    unsigned long known_head;                                      // and the head as of the last time it had to look.
+} Ring;
+Ring parse_ring, format_ring;  // The two rings of the pipelined mode (see "Pipeline subroutines").
+
+
+void initRing(Ring *ring)  // The ring must start out zeroed.
+{
+if ((ring->entries = malloc(RING_SIZE * sizeof(RingEntry))) == 0)
+  {
+  fputs("insufficient memory for ring buffer\n",stderr);
+  exit(18);
+  }
+}
+
+void pin_thread(int cpu)  // Asks for the calling thread to be kept on one CPU; pinning is only a request, so failure is ignored.
+{
+cpu_set_t cpus;
+CPU_ZERO(&cpus);
+CPU_SET(cpu % sysconf(_SC_NPROCESSORS_ONLN),&cpus);
+pthread_setaffinity_np(pthread_self(),sizeof(cpus),&cpus);
+}
+
+void ring_wait(long spins)  // Backs off while waiting on the other side of a ring: spin a while, then give up the CPU.
+{
+if (spins > 1000)
+  sched_yield();
+#if defined(__x86_64__) || defined(__i386__)
+else
+  __builtin_ia32_pause();
+#endif
+}
+
+RingEntry *ring_next_entry(Ring *ring)  // Returns the next entry for the producer to fill, waiting for the consumer to free one up if need be.
+{
+long spins=0;
+while (ring->fill_tail - ring->known_head == RING_SIZE)
+  {
+  __atomic_store_n(&ring->tail,ring->fill_tail,__ATOMIC_RELEASE);  // Make sure the consumer has everything there is before waiting on it.
+  if ((ring->known_head = __atomic_load_n(&ring->head,__ATOMIC_ACQUIRE)) == ring->fill_tail - RING_SIZE)
+    ring_wait(++spins);
+  }
+return(&ring->entries[ring->fill_tail & (RING_SIZE - 1)]);
+}
+
+void ring_filled_entry(Ring *ring)
+{
+if (++ring->fill_tail % RING_BATCH == 0)
+  __atomic_store_n(&ring->tail,ring->fill_tail,__ATOMIC_RELEASE);
+}
+
+void ring_publish(Ring *ring)  // Publishes whatever has been filled so far, short of a whole batch.
+{
+if (__atomic_load_n(&ring->tail,__ATOMIC_RELAXED) != ring->fill_tail)  // Only the producer stores the tail, so it can read its own last store cheaply.
+  __atomic_store_n(&ring->tail,ring->fill_tail,__ATOMIC_RELEASE);
+}
+
+void ring_finish(Ring *ring)  // Publishes whatever is left and tells the consumer there won't be any more.
+{
+__atomic_store_n(&ring->tail,ring->fill_tail,__ATOMIC_RELEASE);
+__atomic_store_n(&ring->finished,1,__ATOMIC_RELEASE);
+}
+
+unsigned long ring_wait_for_entries(Ring *ring,unsigned long head)  // Waits for entries past head to be published, and returns the tail;
+{                                                                   // a tail equal to head means the producer has finished.
+unsigned long tail;
+long spins=0;
+while ((tail = __atomic_load_n(&ring->tail,__ATOMIC_ACQUIRE)) == head)
+  {
+  if (__atomic_load_n(&ring->finished,__ATOMIC_ACQUIRE) && __atomic_load_n(&ring->tail,__ATOMIC_ACQUIRE) == head)
+    break;
+  ring_wait(++spins);
+  }
+return(tail);
+}
+
+void ring_release(Ring *ring,unsigned long head)  // Hands the entries up to head back to the producer.
+{
+__atomic_store_n(&ring->head,head,__ATOMIC_RELEASE);
+}
+
+void ring_put_message(Ring *ring,Book *book,Message *message)  // Passes a copy of a message along, timestamp text and all, to be applied to the given book.
+{
+RingEntry *entry;
+if (message->timestamp_length > (int)sizeof(message->timestamp_text))
+  {
+  fputs("Timestamp too long; continuing.\n",stderr);
+  return;
+  }
+entry = ring_next_entry(ring);
+entry->book    = book;
+entry->message = *message;
+memcpy(entry->message.timestamp_text,message->timestamp,message->timestamp_length);
+ring_filled_entry(ring);
+}
+
+
+/*---------- Snapshot publishing subroutines ----------*/
+
+// With -S file, the book is also published in the shared-memory snapshot described in BookSnapshot.h, for processes on the same
+// box that would otherwise have to tail the output and rebuild the book from it.  After each message, the side it touched is
+// brought up to date in each of the snapshot's two copies, with the sequence number bumped before each to send readers to the
+// other.  Usually that means one level's size, the side's count and its target prices; the levels are walked from the best one
+// again only when a level comes into or drops out of the ones published.  Both copies go through the same changes, half an
+// update apart, so each can be brought up to date from what it held.  The book thread is the only writer, so the locking takes
+// nothing but a store of the sequence number and a fence per copy, and nothing a reader does can hold it up.  Only one book can publish: the book of the single-book modes, or the consolidated book with -V.
+
+char *snapshot_file_name;  // Set by -S.
+typedef char snapshot_target_check[MAX_TARGETS <= BOOK_SNAPSHOT_TARGETS ? 1 : -1];  // Fails to compile if the snapshot can't hold every target size.
+
+
+static inline void publish_side_prices(BookSide *book_side,int64_t prices[])
+{
+int n;
+for (n = 0; n < target_count; n++)  // The prices last printed, which stand for the side as it was when last priced; with -C, that can be a batch behind.
+  prices[n] = book_side->previous_count >= target_sizes[n] ? book_side->previous_price[n] : BOOK_SNAPSHOT_NO_PRICE;
+}
+
+SIDE_INLINE void publish_side(BookSide *book_side,struct book_snapshot_level_struct_type levels[],int32_t *level_count,int64_t *count,int64_t prices[],
+                              long changed_price,const char side)  // changed_price is the one level that changed, or NO_PRICE if it could be any.
+{
+long price=NO_PRICE, size;
+int  n;
+for (n = 0; changed_price != NO_PRICE && n < *level_count && levels[n].price != changed_price; n++)
+  ;
+if (changed_price != NO_PRICE && n < *level_count && (size = ladder_level_size(&book_side->ladder,changed_price)))
+  levels[n].size = size;  // A level already published that is still there.
+else
+if (changed_price == NO_PRICE || n < *level_count || *level_count < BOOK_SNAPSHOT_LEVELS || BETTER_PRICE(side,changed_price,levels[n - 1].price))
+  {  // A level came or went among those published (or may have), so walk them again.
+  for (n = 0; n < BOOK_SNAPSHOT_LEVELS && (price = ladder_next_worse(&book_side->ladder,price,side)) != NO_PRICE; n++)
+    {
+    levels[n].price = price;
+    levels[n].size  = ladder_level_size(&book_side->ladder,price);
+    }
+  *level_count = n;
+  }
+*count = book_side->current_count;
+publish_side_prices(book_side,prices);
+}
+
+static inline struct book_snapshot_struct_type *snapshot_copy_to_change(Book *book,int n)  // Sends readers to the other copy, and returns copy n to be changed.
+{
+struct book_snapshot_file_struct_type *shared = book->snapshot;
+__atomic_store_n(&shared->sequence,shared->sequence + 1,__ATOMIC_RELEASE);  // After whatever was last written to the other copy.
+__atomic_thread_fence(__ATOMIC_RELEASE);                                   // And copy n can't start to change before this shows.
+return(&shared->copies[n]);
+}
+
+void publish_snapshot(Book *book,Message *message,char side,long price)  // Brings the snapshot up to date with a message that changed one side of the book at price (or neither, if side is 0).
+{
+struct book_snapshot_struct_type *snapshot;
+int length=0, n;
+if (message)
+  {
+  ready_timestamp(message);
+  length = message->timestamp_length < (int)sizeof(snapshot->timestamp) ? message->timestamp_length : (int)sizeof(snapshot->timestamp) - 1;
+  }
+for (n = 0; n < 2; n++)  // The sequence number is even between updates, so copy 0 is the one readers are taking until the first bump.
+  {
+  snapshot = snapshot_copy_to_change(book,n);
+  snapshot->message_count++;
+  if (message)
+    {
+    memcpy(snapshot->timestamp,message->timestamp,length);
+    snapshot->timestamp[length] = 0;
+    }
+  if (side == 'S')
+    publish_side(&book->ask,snapshot->asks,&snapshot->ask_level_count,&snapshot->ask_count,snapshot->buy_price,price,'S');
+  if (side == 'B')
+    publish_side(&book->bid,snapshot->bids,&snapshot->bid_level_count,&snapshot->bid_count,snapshot->sell_price,price,'B');
+  }
+}
+
+void publish_prices(Book *book)  // Brings just the target prices up to date, for when they are worked out apart from the messages that changed them (-C).
+{
+struct book_snapshot_struct_type *snapshot;
+int n;
+for (n = 0; n < 2; n++)
+  {
+  snapshot = snapshot_copy_to_change(book,n);
+  publish_side_prices(&book->ask,snapshot->buy_price);
+  publish_side_prices(&book->bid,snapshot->sell_price);
+  }
+}
+
+void open_snapshot(char *file_name,Book *book)  // Creates the snapshot file and fills it in from the book as it stands, which may have come from a checkpoint.
+{
+struct book_snapshot_file_struct_type *book_snapshot;
+int file_descriptor, copy, n;
+if ((file_descriptor = open(file_name,O_RDWR | O_CREAT | O_TRUNC,0644)) < 0 || ftruncate(file_descriptor,sizeof(struct book_snapshot_file_struct_type)) < 0 ||
+    (book_snapshot = mmap(0,sizeof(struct book_snapshot_file_struct_type),PROT_READ | PROT_WRITE,MAP_SHARED,file_descriptor,0)) == MAP_FAILED)
+  {
+  fputs("Unable to set up the snapshot file.\n",stderr);
+  exit(25);
+  }
+close(file_descriptor);
+book_snapshot->version = BOOK_SNAPSHOT_VERSION;
+for (copy = 0; copy < 2; copy++)
+  {
+  book_snapshot->copies[copy].target_count = target_count;
+  for (n = 0; n < target_count; n++)
+    book_snapshot->copies[copy].target_sizes[n] = target_sizes[n];
+  }
+book->snapshot = book_snapshot;
+publish_snapshot(book,0,'S',NO_PRICE);
+publish_snapshot(book,0,'B',NO_PRICE);
+book_snapshot->copies[0].message_count = book_snapshot->copies[1].message_count = 0;
+__atomic_store_n(&book_snapshot->magic,BOOK_SNAPSHOT_MAGIC,__ATOMIC_RELEASE);  // Last, so a reader that sees the magic number sees the rest.
+}
+
+
+/*---------- Rolling statistics subroutines ----------*/
+
+// With -R file, statistics of the target prices over sliding windows of feed time are worked out as the prices are, and written
+// to the file, instead of being worked out afterward from the output.  The windows are given in milliseconds with -w (a comma
+// list; 60000 if there is no -w), and the statistics are written as of each multiple of the -t interval (1000 ms by default),
+// counting from midnight, once the feed has gone past it, and as of the next one at the end.  There is a line
+//   timestamp window target buy_vwap sell_vwap buy_twap sell_twap spread_low spread_high
+// for each window and target size, in dollars for the target size, as in the output, or NA where there is nothing to go on.
+// The VWAP is the average of the prices printed during the window (each of them is for the same number of shares, so that is
+// their volume-weighted average), the TWAP their average weighted by how long each one held over the part of the window that
+// there was a price, and the spread is the buy price less the sell price, for as long as there were both.
+//
+// Each message's timestamp is turned into a number once, and each price printed is kept once, in a queue for its target size
+// and side that all the windows share.  Each window keeps its own place in the queue and running sums over the prices from
+// there on, adding each price as it comes and taking it off again when it falls out of the window, so a price is added and
+// taken off once per window no matter how many times the statistics are written.  The spread's lows and highs are kept in a
+// monotonic queue per window instead: a new spread drops every spread before it that it is at least as low as (or high as),
+// since none of them can be the lowest again, so the lowest in the window is always the first one not yet out of it.  The
+// windows start out empty when a run is resumed from a checkpoint.
+
+#define MAX_WINDOWS           8
+#define ROLLING_OPEN          0x7fffffffffffffffLL  // The end of a point that still holds.
+#define ROLLING_NONE          (-0x7fffffffffffffffL - 1)  // A statistic with nothing to go on, written as NA; a spread can be any other value, NO_PRICE included.
+#define ROLLING_QUEUE_INITIAL 1024                  // Points a queue has room for at first; it doubles whenever it fills up.
+
+typedef struct {
+    long long time;   // When the point came in, in milliseconds of feed time.
+    long long end;    // When the next one took over, or ROLLING_OPEN.
+    long      value;  // A price in cents (NO_PRICE for NA), or a spread.
+} RollingPoint;
+
+typedef struct {
+    RollingPoint  *points;
+    unsigned long mask;         // Room for mask + 1 points, a power of 2.
+    unsigned long first, last;  // The points kept are numbered first up to last; the numbers only ever count up.
+} RollingQueue;
+
+typedef struct {
+    unsigned long head;         // The first point of the price queue that may still be in the window.
+    long long     area, span;   // Over the prices from head on that have ended: cents times milliseconds, and milliseconds.
+    long long     total;        // Over all the prices from head on: their sum,
+    long          count;        // and how many there are.
+} RollingSum;
+
+typedef struct rolling_struct_type {
+    RollingQueue prices[MAX_TARGETS][2];                                         // Each target size's buy ([0]) and sell ([1]) prices.
+    RollingSum   sums[MAX_WINDOWS][MAX_TARGETS][2];
+    RollingQueue low[MAX_WINDOWS][MAX_TARGETS], high[MAX_WINDOWS][MAX_TARGETS];  // The spreads that could still be the lowest or highest in the window.
+    long long    now;                                                            // Feed time, as of the latest message.
+    long long    next_report;                                                    // When the statistics are next to be written as of; -1 before the first message.
+} Rolling;
+
+char *rolling_file_name;                 // Set by -R.
+FILE *rolling_file;
+long rolling_windows[MAX_WINDOWS];       // Set by -w.
+int  rolling_window_count;
+long rolling_interval=1000;              // Set by -t.
+
+
+static inline RollingPoint *rolling_point(RollingQueue *queue,unsigned long number)
+{
+return(&queue->points[number & queue->mask]);
+}
+
+void rolling_push(RollingQueue *queue,long long time,long value)  // Adds a point that holds from time on.
+{
+RollingPoint *points;
+unsigned long mask, i;
+if (!queue->points || queue->last - queue->first > queue->mask)  // Full, or not set up yet?  Then double it, keeping the numbering.
+  {
+  mask = queue->points ? 2 * queue->mask + 1 : ROLLING_QUEUE_INITIAL - 1;
+  if ((points = malloc((mask + 1) * sizeof(RollingPoint))) == 0)
+    {
+    fputs("insufficient memory for rolling statistics\n",stderr);
+    exit(18);
+    }
+  for (i = queue->first; i != queue->last; i++)
+    points[i & mask] = queue->points[i & queue->mask];
+  free(queue->points);
+  queue->points = points;
+  queue->mask   = mask;
+  }
+points = rolling_point(queue,queue->last++);
+points->time  = time;
+points->end   = ROLLING_OPEN;
+points->value = value;
+}
+
+void rolling_end(RollingQueue *queue,long long time)  // Ends the newest point, if it hasn't ended already.
+{
+if (queue->last != queue->first && rolling_point(queue,queue->last - 1)->end == ROLLING_OPEN)
+  rolling_point(queue,queue->last - 1)->end = time;
+}
+
+void rolling_spread(Rolling *rolling,int target_number)  // Takes note of the spread of a target size after either of its prices has changed.
+{
+RollingQueue *buys = &rolling->prices[target_number][0], *sells = &rolling->prices[target_number][1], *low, *high;
+long buy  = buys->last  != buys->first  ? rolling_point(buys,buys->last - 1)->value   : NO_PRICE;
+long sell = sells->last != sells->first ? rolling_point(sells,sells->last - 1)->value : NO_PRICE;
+int  w;
+for (w = 0; w < rolling_window_count; w++)
+  {
+  low  = &rolling->low[w][target_number];
+  high = &rolling->high[w][target_number];
+  rolling_end(low,rolling->now);
+  rolling_end(high,rolling->now);
+  if (buy == NO_PRICE || sell == NO_PRICE)
+    continue;
+  while (low->last != low->first && rolling_point(low,low->last - 1)->value >= buy - sell)
+    low->last--;
+  while (high->last != high->first && rolling_point(high,high->last - 1)->value <= buy - sell)
+    high->last--;
+  rolling_push(low,rolling->now,buy - sell);
+  rolling_push(high,rolling->now,buy - sell);
+  }
+}
+
+void rolling_price(Rolling *rolling,int target_number,char action,long cents)  // Takes note of a buy or sell price (or NA) just printed for a target size.
+{
+int side = action == 'S', w;
+RollingQueue *prices = &rolling->prices[target_number][side];
+RollingPoint *point;
+RollingSum *sum;
+//
+if (prices->last != prices->first)  // The price this one takes over from has now ended, so it counts toward the TWAP.
+  {
+  point = rolling_point(prices,prices->last - 1);
+  point->end = rolling->now;
+  if (point->value != NO_PRICE)
+    for (w = 0; w < rolling_window_count; w++)
+      {
+      sum = &rolling->sums[w][target_number][side];
+      sum->area += point->value * (point->end - point->time);
+      sum->span += point->end - point->time;
+      }
+  }
+rolling_push(prices,rolling->now,cents);
+if (cents != NO_PRICE)
+  for (w = 0; w < rolling_window_count; w++)
+    {
+    rolling->sums[w][target_number][side].total += cents;
+    rolling->sums[w][target_number][side].count++;
+    }
+rolling_spread(rolling,target_number);
+}
+
+long rolling_average(RollingSum *sum,RollingQueue *prices,long long start,long long as_of,int time_weighted)  // One side's VWAP or TWAP over the window from start on.
+{
+RollingPoint *head, *newest;
+long long area=sum->area, span=sum->span, total=sum->total, from;
+long count=sum->count;
+//
+if (sum->head == prices->last)
+  return(ROLLING_NONE);
+head   = rolling_point(prices,sum->head);
+newest = rolling_point(prices,prices->last - 1);
+if (head->time <= start && head->value != NO_PRICE)  // The price the window starts with was printed before the window, so only the part of its time inside counts.
+  {
+  total -= head->value;
+  count--;
+  if (head->end != ROLLING_OPEN)
+    {
+    area -= head->value * (start - head->time);
+    span -= start - head->time;
+    }
+  }
+if (newest->value != NO_PRICE)  // The price still holding counts from when it came in, or the window's start, up to now.
+  {
+  from  = newest->time > start ? newest->time : start;
+  area += newest->value * (as_of - from);
+  span += as_of - from;
+  }
+if (time_weighted)
+  return(span ? area / span : ROLLING_NONE);
+return(count ? total / count : ROLLING_NONE);
+}
+
+void rolling_print_cents(long cents)
+{
+if (cents == ROLLING_NONE)
+  fputs(" NA",rolling_file);
+else
+  fprintf(rolling_file," %s%ld.%02ld",cents < 0 ? "-" : "",labs(cents) / 100,labs(cents) % 100);
+}
+
+void rolling_report(Rolling *rolling,long long as_of)  // Writes the statistics of every window as it stands at the given time.
+{
+RollingQueue *prices, *low, *high;
+RollingPoint *point;
+RollingSum *sum;
+unsigned long first;
+long long start;
+int w, t, side;
+//
+for (w = 0; w < rolling_window_count; w++)
+  {
+  start = as_of - rolling_windows[w];
+  for (t = 0; t < target_count; t++)
+    {
+    for (side = 0; side < 2; side++)  // Move the window's place in each price queue up past the prices that ended before its start.
+      {
+      prices = &rolling->prices[t][side];
+      sum    = &rolling->sums[w][t][side];
+      while (sum->head != prices->last && (point = rolling_point(prices,sum->head))->end <= start)
+        {
+        if (point->value != NO_PRICE)
+          {
+          sum->area  -= point->value * (point->end - point->time);
+          sum->span  -= point->end - point->time;
+          sum->total -= point->value;
+          sum->count--;
+          }
+        sum->head++;
+        }
+      }
+    low  = &rolling->low[w][t];
+    high = &rolling->high[w][t];
+    while (low->first != low->last && rolling_point(low,low->first)->end <= start)
+      low->first++;
+    while (high->first != high->last && rolling_point(high,high->first)->end <= start)
+      high->first++;
+    fprintf(rolling_file,"%lld %ld %ld",as_of,rolling_windows[w],target_sizes[t]);
+    rolling_print_cents(rolling_average(&rolling->sums[w][t][0],&rolling->prices[t][0],start,as_of,0));
+    rolling_print_cents(rolling_average(&rolling->sums[w][t][1],&rolling->prices[t][1],start,as_of,0));
+    rolling_print_cents(rolling_average(&rolling->sums[w][t][0],&rolling->prices[t][0],start,as_of,1));
+    rolling_print_cents(rolling_average(&rolling->sums[w][t][1],&rolling->prices[t][1],start,as_of,1));
+    rolling_print_cents(low->first != low->last ? rolling_point(low,low->first)->value : ROLLING_NONE);
+    rolling_print_cents(high->first != high->last ? rolling_point(high,high->first)->value : ROLLING_NONE);
+    fputc('\n',rolling_file);
+    }
+  }
+for (t = 0; t < target_count; t++)  // The price queues need keep nothing from before the place of the window furthest back.
+  for (side = 0; side < 2; side++)
+    {
+    for (first = rolling->sums[0][t][side].head, w = 1; w < rolling_window_count; w++)
+      if (rolling->sums[w][t][side].head < first)
+        first = rolling->sums[w][t][side].head;
+    rolling->prices[t][side].first = first;
+    }
+}
+
+void rolling_advance(Rolling *rolling,Message *message)  // Moves feed time up to a message's timestamp, writing the statistics as of any report times that passes.
+{
+long long now = message_time(message);
+if (rolling->next_report < 0)
+  rolling->next_report = (now + rolling_interval - 1) / rolling_interval * rolling_interval;
+while (now > rolling->next_report)
+  {
+  rolling_report(rolling,rolling->next_report);
+  rolling->next_report += rolling_interval;
+  }
+if (now > rolling->now)  // A timestamp out of order doesn't take feed time back.
+  rolling->now = now;
+}
+
+void set_rolling_windows(char *list)  // Takes the windows from a -w list.
+{
+char *p = list;
+do
+  {
+  if (rolling_window_count == MAX_WINDOWS || (rolling_windows[rolling_window_count++] = strtol(p,&p,10)) <= 0 || (*p && *p != ','))
+    {
+    fputs("Rolling statistics windows (-w) are up to 8 numbers of milliseconds, separated by commas.\n",stderr);
+    exit(1);
+    }
+  }
+while (*p++);
+}
+
+void open_rolling(char *file_name,Book *book)
+{
+if ((rolling_file = fopen(file_name,"w")) == 0 || (book->rolling = calloc(1,sizeof(Rolling))) == 0)
+  {
+  fputs("Unable to set up the rolling statistics file.\n",stderr);
+  exit(26);
+  }
+book->rolling->next_report = -1;
+if (!rolling_window_count)
+  rolling_windows[rolling_window_count++] = 60000;
+}
+
+void finish_rolling(Rolling *rolling)  // Writes the statistics as of the end of the feed.
+{
+if (rolling->next_report >= 0)
+  rolling_report(rolling,rolling->next_report);
+if (fclose(rolling_file))
+  {
+  fputs("Error writing output.\n",stderr);
+  exit(30);
+  }
+}
+
+
+/*---------- Program-level subroutines ----------*/
+
+long total_price_from_ladder(PriceLadder *ladder,long target_size)  // Returns price of first x shares in ladder in cents.
+{
+long shares_remaining=target_size;
+long total_price_in_cents=0;
+long level_price=ladder_next_worse(ladder,NO_PRICE,ladder->side), level_size;
+//
+while (((target_size - shares_remaining) < target_size) && (level_price != NO_PRICE))
+  {
+  level_size = ladder_level_size(ladder,level_price);
+  if (level_size >= shares_remaining)  // Does this level hold enough shares to fulfill the request for x shares?
+    {
+    total_price_in_cents += shares_remaining * level_price;  // Add to total and break out.
+    break;
+    }
+  total_price_in_cents += level_size * level_price;  // Use all the shares in the current level.
+  shares_remaining -= level_size;                    // Reduce the shares remaining by the size of the current level, of course.
+  level_price = ladder_next_worse(ladder,level_price,ladder->side);
+  }
+if (DEBUG)
+  printf("Returning total price in cents of %ld for %ld shares.\n",total_price_in_cents,target_size);
+return(total_price_in_cents);
+}
+
+SIDE_INLINE long indexed_price_from_ladder(PriceLadder *ladder,long target_size,const char side)  // Same result as total_price_from_ladder(), but uses the cumulative-depth index.
+{
+long shares_remaining=target_size;
+long total_price_in_cents=0;
+long position=0, step, level_size;
+Node *node=firstNode(&ladder->overflow);
+//
+// Overflow levels better than anything in the window come first; they are rare, so they are simply walked.
+for (; node != ladder->overflow.hdr && node && shares_remaining; node = nextNode(&ladder->overflow,node))
+  {
+  if (side == 'S' ? node->key >= ladder->anchor : node->key < ladder->anchor)
+    break;  // This one is beyond the window, so come back to it after the window.
+  level_size = node->data.level.size < shares_remaining ? node->data.level.size : shares_remaining;
+  total_price_in_cents += level_size * node->key;
+  shares_remaining     -= level_size;
+  }
+if (!shares_remaining)
+  return(total_price_in_cents);
+// Then the window itself.  If it doesn't hold enough shares, take all of it; otherwise descend the Fenwick tree to the last
+// depth position whose prefix falls short of the shares remaining, and take the rest from the level just past it.
+if (ladder->index_size[LADDER_TICKS] < shares_remaining)
+  {
+  total_price_in_cents += ladder->index_notional[LADDER_TICKS];
+  shares_remaining     -= ladder->index_size[LADDER_TICKS];
+  }
+else
+  {
+  for (step = LADDER_TICKS / 2; step; step >>= 1)
+    if (ladder->index_size[position + step] < shares_remaining)
+      {
+      position             += step;
+      shares_remaining     -= ladder->index_size[position];
+      total_price_in_cents += ladder->index_notional[position];
+      }
+  return(total_price_in_cents + shares_remaining * (ladder->anchor + DEPTH_POSITION(side,position)));
+  }
+// And finally whatever overflow levels lie beyond the window.
+for (; node != ladder->overflow.hdr && node && shares_remaining; node = nextNode(&ladder->overflow,node))
+  {
+  level_size = node->data.level.size < shares_remaining ? node->data.level.size : shares_remaining;
+  total_price_in_cents += level_size * node->key;
+  shares_remaining     -= level_size;
+  }
+return(total_price_in_cents);
+}
+
+long list_total_size(SkipList *list)  // For use only when DEBUG is turned on.
+{
+Node *list_pointer=firstNode(list);
+long list_total=0;
+while (list_pointer)
+  {
+  list_total += list_pointer->data.level.size;
+  list_pointer = nextNode(list,list_pointer);
+  }
+return(list_total);
+}
+
+long list_total_price(SkipList *list)  // For use only when DEBUG is turned on.
+{
+Node *list_pointer=firstNode(list);
+long list_total=0;
+while (list_pointer)
+  {
+  list_total += list_pointer->data.level.size * list_pointer->key;
+  list_pointer = nextNode(list,list_pointer);
+  }
+return(list_total);
+}
+
+void emit_price_line(Book *book,Message *message,OutputWriter *writer,long tag,char side,long cents)  // Prints a price line, or, with no writer, passes it on to the format thread.
+{
+RingEntry *entry;
+if (writer)
+  {
+  ready_timestamp(message);
+  output_price_line(writer,book->symbol,book->symbol_length,tag,message->timestamp,message->timestamp_length,side,cents);
+  return;
+  }
+entry = ring_next_entry(&format_ring);  // The line travels as a message whose side, price and size are the side, price and tag to print.
+entry->book                     = book;
+entry->message.side             = side;
+entry->message.price            = cents;
+entry->message.size             = tag;
+entry->message.timestamp_length = message->timestamp_length;
+entry->message.timestamp_value  = message->timestamp_value;
+memcpy(entry->message.timestamp_text,message->timestamp,message->timestamp_length);
+ring_filled_entry(&format_ring);
+}
+
+SIDE_INLINE Level *book_add(Book *book,long price,long size,const char side)  // Adds shares at a price to one side of the book; returns the level they went into.
+{
+BookSide *book_side = BOOK_SIDE(book,side);
+Level *level = ladder_add(&book_side->ladder,price,size,side);
+if (target_count == 1)
+  frontier_add(&book_side->frontier,price,size,side);
+book_side->current_count += size;  // Update the current count so it matches the total of the ladder.
+return(level);
+}
+
+SIDE_INLINE void book_reduce(Book *book,Level *level,long price,long size,const char side)  // Takes shares at a price off one side of the book.
+{
+BookSide *book_side = BOOK_SIDE(book,side);
+ladder_reduce(&book_side->ladder,level,price,size,side);
+if (target_count == 1)
+  frontier_reduce(&book_side->frontier,price,size,side);
+book_side->current_count -= size;
+}
+
+SIDE_INLINE void book_price(Book *book,Message *message,OutputWriter *writer,const char side)  // Prints whatever prices on one side of the book have changed.
+{
+BookSide *book_side = BOOK_SIDE(book,side);
+long target_size;                   // The target size being worked on.
+int  target_number;                 // Loop counter for going through them.
+long returned_price;                // Used for receiving the price of the target size.
+const char action = side == 'S' ? 'B' : 'S';  // Shares on offer are there to be bought, and shares bid for to be sold.
+//
+for (target_number = 0; target_number < target_count; target_number++)
+  {
+  target_size = target_sizes[target_number];
+  if (book_side->current_count >= target_size)
+    {
+    if (target_count == 1)
+      returned_price = book_side->frontier.notional;  // The fill frontier keeps this up to date, so there is no need to walk the ladder.
+    else
+      returned_price = indexed_price_from_ladder(&book_side->ladder,target_size,side);
+    INSTRUMENT_STAGE(STAGE_PRICE);
+    if (returned_price != book_side->previous_price[target_number])
+      {
+      emit_price_line(book,message,writer,target_count > 1 ? target_size : 0,action,returned_price);
+      if (book->rolling)
+        rolling_price(book->rolling,target_number,action,returned_price);
+      INSTRUMENT_STAGE(STAGE_FORMAT);
+      }
+    book_side->previous_price[target_number] = returned_price;
+    }
+  else
+  if (book_side->previous_count >= target_size)  // Count fell below the target size?
+    {
+    emit_price_line(book,message,writer,target_count > 1 ? target_size : 0,action,NO_PRICE);
+    if (book->rolling)
+      rolling_price(book->rolling,target_number,action,NO_PRICE);
+    INSTRUMENT_STAGE(STAGE_FORMAT);
+    book_side->previous_price[target_number] = 0;
+    }
+  }
+book_side->previous_count = book_side->current_count;  // Reset this for the next go-around.
+}
+
+// With -C, prices aren't worked out after every message.  Messages are applied to the book as they come, but the sides they
+// change are only priced once the batch they belong to is over: all the messages with the same timestamp (-C 0), or all those
+// in the same interval of so many milliseconds (-C N), counting from midnight.  A batch is over when a message from another
+// one comes along for the same book, or at the end of the input, before a checkpoint, or whenever a live feed runs dry.
+// Each side the batch changed is priced once, and an output line comes out for each target size whose price (or NA) ended up
+// different from before the batch, with the timestamp of the batch's latest message.  A burst of adds and cancels that leaves
+// the price where it was prints nothing at all.
+
+unsigned long long message_bucket(Message *message)  // The time bucket a message falls in, for -C.
+{
+unsigned long long value = message_time(message);
+return(coalesce_interval > 1 ? value / coalesce_interval : value);
+}
+
+void book_hold_message(Book *book,Message *message,char side,unsigned long long bucket)  // Adds a message that has been applied to the book to the batch waiting to be priced.
+{
+book->pending_sides |= side == 'S' ? 1 : side == 'B' ? 2 : 0;
+book->pending_bucket = bucket;
+book->pending_message.timestamp_length = message->timestamp_length;
+book->pending_message.timestamp_value  = message->timestamp_value;
+memcpy(book->pending_message.timestamp_text,message->timestamp,message->timestamp_length);  // The input it points into may be gone by the time the batch is priced.
+book->pending_message.timestamp = book->pending_message.timestamp_text;
+}
+
+void book_price_batch(Book *book,OutputWriter *writer)  // Prices the sides the waiting batch changed, once each.
+{
+if (book->rolling)  // Its prices go with the time of the batch's latest message, which a message skipped since may have gone past.
+  book->rolling->now = message_time(&book->pending_message);
+if (book->pending_sides & 2)
+  book_price(book,&book->pending_message,writer,'B');
+if (book->pending_sides & 1)
+  book_price(book,&book->pending_message,writer,'S');
+if (book->snapshot)
+  publish_prices(book);
+book->pending_sides = 0;
+}
+
+void book_process_message(Book *book,Message *message,OutputWriter *writer)  // Applies a message to a book, and prints whatever prices it changes.
+{
+char side = book->last_side;        // Working variables for passing values on from the input-processing code to the output-determining code.
+long price=NO_PRICE;                // In cents
+long size;                          // Number of shares
+long target_size;                   // The target size being worked on, in the DEBUG checks.
+int  target_number;                 // Loop counter for going through them.
+struct order_slot_struct_type *order_pointer;  // This is for working with the order table entry of a reduce.
+Order *order;                       // And this for the order it points to.
+Level *level=0;                     // The price level an order goes into or comes out of.
+unsigned long long bucket=0;        // The message's time bucket, with -C.
+//
+if (coalesce_interval >= 0 && (bucket = message_bucket(message)) != book->pending_bucket && book->pending_sides)  // Start of a new batch?  Then price the last one first.
+  book_price_batch(book,writer);
+if (book->rolling)  // Feed time moves on (see "Rolling statistics subroutines").
+  rolling_advance(book->rolling,message);
+//
+// Now decide what course to take depending upon the value of the operation type we found.  Each of the side routines is
+// called with a constant side, so that each call gets its own copy of the routine with that side built in.
+
+if (message->operation_type == 'A')  // Add order to book.
+  {
+  //
+  // Save relevant values in local variables so we can fall through to common code below.  The timestamp comes along with the message.
+  side  = message->side;
+  price = message->price;
+  size  = message->size;
+  //
+  // Add to appropriate places; all entries go into the order table, but into only one of the sides.  The level goes in first,
+  // so that the order can be queued at it.
+  //
+  if (side == 'S')  // We want to buy from lowest price to highest, so offers to sell go into this side.
+    level = book_add(book,price,size,'S');
+  if (side == 'B')  // We want to sell from highest price to lowest, so offers to buy go into this side.
+    level = book_add(book,price,size,'B');
+  INSTRUMENT_STAGE(STAGE_LEVEL);
+  order_table_insert(&book->order_table,message->order_key,message->order_key_extra,side,price,size,level);
+  INSTRUMENT_STAGE(STAGE_LOOKUP);
+  }
+
+if (message->operation_type == 'R')  // Reduce/remove order.
+  {
+  order_pointer = order_table_find(&book->order_table,message->order_key,message->order_key_extra);  // We need to do to this lookup to find the side and price more than anything.
+  if (!order_pointer)  // Failed to look up supplied order id?
+    {
+    fputs("Failed to look up order id; continuing.\n",stderr);
+    INSTRUMENT_STAGE(STAGE_LOOKUP);
+    if (book->snapshot)  // The snapshot still counts the message, though it changes nothing.
+      publish_snapshot(book,message,0,NO_PRICE);
+    INSTRUMENT_MESSAGE_DONE(CLASS_OTHER);
+    return;
+    }
+  order = order_at(book->order_table.pool,order_pointer->order);
+  side  = order->side;                              // Save these three variables.
+  price = order_price(book->order_table.pool,order);  // We will need this to work with the two ladders that are sorted by price.
+  size  = message->size;                            // The amount to reduce the order size by.
+  if (size > order_size(book->order_table.pool,order))  // Is pesky input data trying to reduce the order by more than its current size?
+    size  = order_size(book->order_table.pool,order);  // If so, then skip that BS here and just use the original amount.
+  level = order->level;   // The order knows its level, so there is no looking up the price in the ladder.
+  //
+  // Now reduce entries in the order table and the appropriate side, or, if their sizes fall to 0, delete them.
+  // The order table entry is reduced in place, since we are already holding a pointer to its slot.  That goes first, so that
+  // an order that has run out is out of its level's queue before the level can go away.
+  //
+  order_table_reduce(&book->order_table,order_pointer,size);
+  INSTRUMENT_STAGE(STAGE_LOOKUP);
+  if (side == 'S')
+    book_reduce(book,level,price,size,'S');
+  if (side == 'B')
+    book_reduce(book,level,price,size,'B');
+  INSTRUMENT_STAGE(STAGE_LEVEL);
+  }
+book->last_side = side;
+
+// Now, based upon what side the last add or reduce/remove operation referenced, decide what to do.  The counts on a side can
+// have changed only if the last order_id processed was on that side, so only that side is priced.  (The two blocks of code
+// that used to do this were so much identical that they are now the one book_price().)  With -C, the side waits to be priced
+// with the rest of its batch, unless the timestamp is too long to keep, in which case the message is a batch of its own.
+//
+if (coalesce_interval >= 0 && message->timestamp_length <= (int)sizeof(message->timestamp_text))
+  book_hold_message(book,message,side,bucket);
+else
+  {
+  if (book->pending_sides)
+    book_price_batch(book,writer);
+  if (side == 'B')
+    book_price(book,message,writer,'B');
+  if (side == 'S')
+    book_price(book,message,writer,'S');
+  }
+if (book->snapshot)  // Publish the side that changed to any local readers (see "Snapshot publishing subroutines").
+  publish_snapshot(book,message,side,price);  // A message that was neither an add nor a reduce leaves price as NO_PRICE.
+INSTRUMENT_MESSAGE_DONE(message_class(message->operation_type,side));
+
+if (DEBUG)  // If DEBUG is turned on, then print totals and do consistency checks after every single input line has been processed.
+  {         // This code could be omitted from the final program, but is left here as an illustration of the program development process.
+  printf("Current ask count: %ld\n",book->ask.current_count);
+  printf("Current bid count: %ld\n",book->bid.current_count);
+  //
+  // Show total sizes in the order table and both ladders.
+  temp_long = order_table_total_size(&book->order_table);
+  printf("Order table size total: %ld\n",temp_long);
+  temp_long = ladder_total_size(&book->ask.ladder);
+  printf("Ask ladder size total: %ld\n",temp_long);
+  temp_long = ladder_total_size(&book->bid.ladder);
+  printf("Bid ladder size total: %ld\n",temp_long);
+  //
+  // Check to make sure that sizes in the two price ladders add up to the total size of the order table.
+  if (ladder_total_size(&book->ask.ladder) + ladder_total_size(&book->bid.ladder) != order_table_total_size(&book->order_table))
+    fputs("ERROR: The two price ladders' sizes don't add up to the order table's total.\n",stderr);
+  // The next two statements check to make sure that the count variables we maintain never vary from the amounts in the ladders, since they are, after all, duplicate data.
+  if (book->ask.current_count != ladder_total_size(&book->ask.ladder))
+    fputs("ERROR: current_ask_count <> total size of ask_ladder!\n",stderr);
+  if (book->bid.current_count != ladder_total_size(&book->bid.ladder))
+    fputs("ERROR: current_bid_count <> total size of bid_ladder!\n",stderr);
+  //
+  // Show total prices in the order table and both ladders.
+  temp_long = order_table_total_price(&book->order_table);
+  printf("Order table price total: %ld\n",temp_long);
+  temp_long = ladder_total_price(&book->ask.ladder);
+  printf("Ask ladder price total: %ld\n",temp_long);
+  temp_long = ladder_total_price(&book->bid.ladder);
+  printf("Bid ladder price total: %ld\n",temp_long);
+  //
+  // As before, check that the total prices in the two price ladders add up to the total price of the order table.
+  if (ladder_total_price(&book->ask.ladder) + ladder_total_price(&book->bid.ladder) != order_table_total_price(&book->order_table))
+    fputs("ERROR: The two price ladders' prices don't add up to the order table's total.\n",stderr);
+  // Every order queued at a level has to be in the order table too (the table can hold more, for orders with neither side).
+  if (ladder_check_queues(&book->ask.ladder) + ladder_check_queues(&book->bid.ladder) > (long)book->order_table.count)
+    fputs("ERROR: More orders are queued at the price levels than there are in the order table!\n",stderr);
+  // The fill frontiers (or the cumulative-depth indexes) hold the price of each target size, though, so check those against a full walk of each ladder.
+  for (target_number = 0; target_number < target_count; target_number++)
+    {
+    target_size = target_sizes[target_number];
+    if (book->ask.current_count >= target_size && (target_count == 1 ? book->ask.frontier.notional : indexed_price_from_ladder(&book->ask.ladder,target_size,'S')) != total_price_from_ladder(&book->ask.ladder,target_size))
+      fputs("ERROR: Price of target size from ask_frontier or ask_ladder's index <> price from a walk of ask_ladder!\n",stderr);
+    if (book->bid.current_count >= target_size && (target_count == 1 ? book->bid.frontier.notional : indexed_price_from_ladder(&book->bid.ladder,target_size,'B')) != total_price_from_ladder(&book->bid.ladder,target_size))
+      fputs("ERROR: Price of target size from bid_frontier or bid_ladder's index <> price from a walk of bid_ladder!\n",stderr);
+    }
+  //
+  printf("-----------------------------------------------------------------------\n");
+  }
+}
+
+
+// With -A N, the single-book loop decodes up to N messages ahead of the one being applied, and starts the memory each one
+// will need on its way into the cache well before the book gets to it, so that the cache misses of messages that have nothing
+// to do with one another overlap instead of each lookup waiting for the last one to finish.  As soon as a message is decoded,
+// the order table slot its order ID hashes to is prefetched, along with the price level of an add; once a reduce is halfway
+// to the book, and its slot should be in the cache, the order record the slot points to is prefetched too.  These are only
+// hints, since the messages ahead of it can change the book before it gets there; the messages are still applied one at a
+// time in input order, so the output is exactly the same.  This pays on books too big for the cache (-A 32 ran a book of three
+// million resting orders about 15% faster), but on a book that stays in the cache it is only extra work, so it is off unless
+// asked for.  Going further, to the order's level and its neighbours in the level's queue, cost more than it saved.  A message
+// waiting in the window has its timestamp copied, as in the ring modes, since the input it points into may be read over by
+// then; one whose timestamp is too long to copy waits in the parser's own message instead, and nothing more is decoded until
+// the window has drained and it has been applied.  The window can't be checkpointed, and a live feed isn't read any further while messages are waiting in it, if that
+// would mean waiting on the feed.
+
+#define LOOKAHEAD_MAX 256  // Most messages that can be decoded ahead; a power of 2.
+
+Message       lookahead[LOOKAHEAD_MAX];
+unsigned long lookahead_head, lookahead_tail;  // The messages waiting are numbered head up to tail; the numbers only ever count up.
+int           lookahead_distance;              // Set by -A.
+int           lookahead_held;                  // Set while message itself is waiting behind the window, its timestamp too long to copy.
+Message       *current_message;                // The message being applied by the single-book loop: message itself, or one from the window.
+
+
+void book_prefetch(Book *book,Message *message)  // Starts what a message just decoded will need from the book on its way into the cache.
+{
+Level *level;
+order_table_prefetch(&book->order_table,message->order_key,message->order_key_extra);
+if (message->operation_type == 'A' && (level = ladder_window_level(&BOOK_SIDE(book,message->side)->ladder,message->price)))
+  __builtin_prefetch(level,1);
+}
+
+void book_prefetch_order(Book *book,Message *message)  // Likewise the order record of a reduce, once its slot ought to be in the cache.
+{
+Order *order;
+if (message->operation_type == 'R' && (order = order_table_guess(&book->order_table,message->order_key,message->order_key_extra)))
+  __builtin_prefetch(order,1);
+}
+
+Message *next_lookahead_message(void)  // Returns the next message to apply, after decoding ahead as far as -A allows; returns NULL at end of input.
+{
+Message *next;
+while (!lookahead_held && lookahead_tail - lookahead_head < (unsigned long)lookahead_distance &&
+       (lookahead_tail == lookahead_head || !input_is_live || input_buffered()) && next_message())
+  {
+  if (message.timestamp_length > (int)sizeof(message.timestamp_text))
+    {
+    lookahead_held = 1;
+    break;
+    }
+  next = &lookahead[lookahead_tail++ & (LOOKAHEAD_MAX - 1)];
+  *next = message;
+  memcpy(next->timestamp_text,message.timestamp,message.timestamp_length);
+  next->timestamp = next->timestamp_text;
+  book_prefetch(&book,next);
+  }
+if (lookahead_head == lookahead_tail)
+  {
+  if (!lookahead_held)
+    return(0);
+  lookahead_held = 0;
+  return(&message);
+  }
+if (lookahead_tail - lookahead_head > (unsigned long)lookahead_distance / 2)
+  book_prefetch_order(&book,&lookahead[(lookahead_head + lookahead_distance / 2) & (LOOKAHEAD_MAX - 1)]);
+return(&lookahead[lookahead_head++ & (LOOKAHEAD_MAX - 1)]);
+}
+
+
+/*---------- Multi-symbol subroutines ----------*/
+
+// With -m N, each input line carries a symbol after its timestamp ("timestamp symbol A order_id side price size"), and a book is
+// kept for each symbol.  The books are spread over N worker threads by a hash of the symbol, each worker pinned to its own CPU,
+// while the main thread does nothing but read and parse the input and hand each message to the worker that owns its symbol.  The
+// hand-off is a ring per worker (see "Ring buffer subroutines").  Each worker has its own node pool and output writer; output lines start with the symbol,
+// and the workers' buffers (always whole lines) are written one at a time under a shared lock.  Since a symbol's messages all
+// go through one ring to one worker in order, each symbol's output comes out in order, although the lines of different symbols
+// are interleaved by buffer.  Order IDs need only be unique within a symbol.
+
+#define SYMBOL_TABLE_BITS 10  // The symbol table starts with 1024 slots and doubles whenever it gets half full.
+
+typedef struct {
+    Ring         ring;
+    pthread_t    thread;
+    int          number;
+    NodePool     pool;
+    OutputWriter writer;
+    long         message_count;
+} Worker;
+Worker *workers;
+
+struct symbol_slot_struct_type
+{
+unsigned long long key;  // Symbol packed like an order ID; 0 marks an empty slot.
+unsigned short key_extra;
+Book *book;
+int  worker;             // The worker that owns the book.
+};
+struct symbol_slot_struct_type *symbol_slots;
+unsigned long symbol_mask, symbol_count;
+pthread_mutex_t output_write_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+void *worker_thread(void *argument)
+{
+Worker *worker = argument;
+Ring *ring = &worker->ring;
+RingEntry *entry;
+unsigned long tail, head = 0;
+//
+pin_thread(worker->number + 1);  // CPU 0 is left for the main thread.
+INSTRUMENT_START();
+while ((tail = ring_wait_for_entries(ring,head)) != head)
+  {
+  for (; head != tail; head++)
+    {
+    entry = &ring->entries[head & (RING_SIZE - 1)];
+    if (!entry->book->order_table.slots)  // First message for this symbol?  The book is set up here, so its memory is first touched on this worker's CPU.
+      initBook(entry->book,&worker->pool);
+    entry->message.timestamp = entry->message.timestamp_text;
+    INSTRUMENT_MARK();
+    book_process_message(entry->book,&entry->message,&worker->writer);
+    worker->message_count++;
+    }
+  ring_release(ring,head);
+  }
+finish_output(&worker->writer);
+INSTRUMENT_FINISH();
+return(0);
+}
+
+void start_workers(void)
+{
+int i;
+if ((workers = calloc(worker_count,sizeof(Worker))) == 0 ||
+    (symbol_slots = calloc(1UL << SYMBOL_TABLE_BITS,sizeof(struct symbol_slot_struct_type))) == 0)
+  {
+  fputs("insufficient memory for worker threads\n",stderr);
+  exit(18);
+  }
+symbol_mask = (1UL << SYMBOL_TABLE_BITS) - 1;
+for (i = 0; i < worker_count; i++)
+  {
+  workers[i].number             = i;
+  workers[i].pool.huge_pages    = node_pool.huge_pages;
+  workers[i].writer.flush_mode     = output_writer.flush_mode;  // Same flush policy as the main writer would have had.
+  workers[i].writer.flush_bytes    = output_writer.flush_bytes;
+  workers[i].writer.flush_interval = output_writer.flush_interval;
+  workers[i].writer.write_lock     = &output_write_lock;
+  initOutputWriter(&workers[i].writer,1,writer_thread_wanted);
+  initRing(&workers[i].ring);
+  if (pthread_create(&workers[i].thread,0,worker_thread,&workers[i]))
+    {
+    fputs("Unable to start worker thread.\n",stderr);
+    exit(19);
+    }
+  }
+}
+
+struct symbol_slot_struct_type *symbol_place(unsigned long long key,unsigned short extra)  // Returns the slot of a symbol, or the empty slot where it would go.
+{
+unsigned long i = mix_order_key(key,extra) & symbol_mask;
+while (symbol_slots[i].key && (symbol_slots[i].key != key || symbol_slots[i].key_extra != extra))
+  i = (i + 1) & symbol_mask;
+return(&symbol_slots[i]);
+}
+
+void grow_symbol_table(void)  // There are never very many symbols, so this simply rehashes into a new table twice the size.
+{
+struct symbol_slot_struct_type *old_slots = symbol_slots;
+unsigned long old_mask = symbol_mask, i;
+if ((symbol_slots = calloc(2 * (old_mask + 1),sizeof(struct symbol_slot_struct_type))) == 0)
+  {
+  fputs("insufficient memory growing symbol table\n",stderr);
+  exit(18);
+  }
+symbol_mask = 2 * old_mask + 1;
+for (i = 0; i <= old_mask; i++)
+  if (old_slots[i].key)
+    *symbol_place(old_slots[i].key,old_slots[i].key_extra) = old_slots[i];
+free(old_slots);
+}
+
+void dispatch_message(void)  // Hands the message just parsed to the worker that owns its symbol's book, setting up the book if it's a new symbol.
+{
+struct symbol_slot_struct_type *slot;
+unsigned short extra;
+unsigned long long key = feed_order_id_to_key(symbol_pointer,symbol_length,&extra);  // Like an order ID, only the first 10 characters count.
+//
+if (!(slot = symbol_place(key,extra))->key)
+  {
+  if (2 * (symbol_count + 1) > symbol_mask + 1)
+    {
+    grow_symbol_table();
+    slot = symbol_place(key,extra);
+    }
+  if ((slot->book = calloc(1,sizeof(Book))) == 0)  // The worker sets the rest of it up when the first message gets there.
+    {
+    fputs("insufficient memory for symbol's book\n",stderr);
+    exit(18);
+    }
+  slot->book->symbol_length = symbol_length < FEED_ORDER_ID_MAX_LENGTH ? symbol_length : FEED_ORDER_ID_MAX_LENGTH;
+  memcpy(slot->book->symbol,symbol_pointer,slot->book->symbol_length);
+  slot->key    = key;
+  slot->key_extra = extra;
+  slot->worker = (mix_order_key(key,extra) >> 32) % worker_count;  // The high half of the hash, so as not to follow the slot number.
+  symbol_count++;
+  }
+ring_put_message(&workers[slot->worker].ring,slot->book,&message);
+}
+
+void finish_workers(void)  // Tells the workers there is no more input, and waits for them to finish up their output.
+{
+int i;
+for (i = 0; i < worker_count; i++)
+  ring_finish(&workers[i].ring);
+for (i = 0; i < worker_count; i++)
+  {
+  pthread_join(workers[i].thread,0);
+  node_pool.live_count  += workers[i].pool.live_count;  // Totals for the statistics report.
+  node_pool.peak_count  += workers[i].pool.peak_count;
+  node_pool.chunk_count += workers[i].pool.chunk_count;
+  node_pool.order_live_count  += workers[i].pool.order_live_count;
+  node_pool.order_peak_count  += workers[i].pool.order_peak_count;
+  tally_pool_memory(&workers[i].pool);
+  release_node_pool(&workers[i].pool);
+  }
+for (i = 0; i <= (int)symbol_mask; i++)
+  if (symbol_slots[i].key)
+    tally_book_memory(symbol_slots[i].book);
+}
+
+
+/*---------- Pipeline subroutines ----------*/
+
+// With -P, a single feed is worked on by three threads instead of one, each pinned to its own CPU: the main thread reads and
+// parses the input, a book thread applies each message to the book and prices it, and a format thread turns the prices into
+// output lines and writes them out.  Parsed messages go from the main thread to the book thread through one ring, and the price
+// lines from the book thread to the format thread through another (see "Ring buffer subroutines"); the book thread publishes
+// the lines from each batch of messages when it has finished the batch.  Every message and every line still goes down a single
+// path in its original order, so the output is exactly what it would have been without -P.  The book can't be checkpointed
+// while the book thread has it, so -P can't be combined with -c, although it can resume from a checkpoint with -r.
+
+pthread_t book_thread_id, format_thread_id;
+
+
+void *book_thread(void *argument)
+{
+RingEntry *entry;
+unsigned long tail, head = 0;
+//
+(void)argument;
+pin_thread(1);
+INSTRUMENT_START();
+while ((tail = ring_wait_for_entries(&parse_ring,head)) != head)
+  {
+  for (; head != tail; head++)
+    {
+    entry = &parse_ring.entries[head & (RING_SIZE - 1)];
+    entry->message.timestamp = entry->message.timestamp_text;
+    INSTRUMENT_MARK();
+    book_process_message(entry->book,&entry->message,0);
+    }
+  ring_release(&parse_ring,head);
+  if (live_address && book.pending_sides)  // A live feed has run dry (or nearly), so don't sit on the batch.
+    book_price_batch(&book,0);
+  ring_publish(&format_ring);  // Hand over the lines from this batch before waiting for the next one.
+  }
+if (book.pending_sides)
+  book_price_batch(&book,0);
+ring_finish(&format_ring);
+INSTRUMENT_FINISH();
+return(0);
+}
+
+void *format_thread(void *argument)
+{
+RingEntry *entry;
+unsigned long tail, head = 0;
+//
+(void)argument;
+pin_thread(2);
+while ((tail = ring_wait_for_entries(&format_ring,head)) != head)
+  {
+  for (; head != tail; head++)
+    {
+    entry = &format_ring.entries[head & (RING_SIZE - 1)];
+    entry->message.timestamp = entry->message.timestamp_text;
+    ready_timestamp(&entry->message);
+    output_price_line(&output_writer,entry->book->symbol,entry->book->symbol_length,entry->message.size,
+                      entry->message.timestamp,entry->message.timestamp_length,entry->message.side,entry->message.price);
+    }
+  ring_release(&format_ring,head);
+  }
+return(0);
+}
+
+void start_pipeline(void)
+{
+initRing(&parse_ring);
+initRing(&format_ring);
+pin_thread(0);
+if (pthread_create(&book_thread_id,0,book_thread,0) || pthread_create(&format_thread_id,0,format_thread,0))
+  {
+  fputs("Unable to start pipeline thread.\n",stderr);
+  exit(19);
+  }
+}
+
+void pipeline_message(void)  // Hands the message just parsed to the book thread.
+{
+ring_put_message(&parse_ring,&book,&message);
+if (input_data == input_data_end)  // About to wait for more input?  Then don't leave the book thread waiting on what has been read already.
+  ring_publish(&parse_ring);
+}
+
+void finish_pipeline(void)  // Tells the book thread there is no more input, and waits for the last of the output to be formatted.
+{
+ring_finish(&parse_ring);
+pthread_join(book_thread_id,0);
+pthread_join(format_thread_id,0);
+}
+
+
+/*---------- Venue subroutines ----------*/
+
+// With -V [name=]feed, given once for each venue, the program keeps one consolidated book of the same instrument as it trades
+// on several venues.  Each feed is a file, or a live feed taken as with -L if it is given as socket:address, and each is read
+// and parsed by a thread of its own, which hands its messages to the main thread through a ring (see "Ring buffer
+// subroutines").  The main thread merges the feeds by timestamp, keeping the venues in a small heap ordered by the timestamp
+// of each one's next message (the venue given first goes first on a tie), and applies every message to the consolidated book,
+// so that the target sizes are priced from the depth of all the venues together.  A message can't be placed until every feed
+// has a message waiting or has ended, so a quiet live feed holds the others up.  Order IDs need only be unique within a venue:
+// the venue's number is put into the spare bits of the packed order key (FEED_KEY_SPARE_BITS), which an order ID of ASCII
+// characters never sets.
+//
+// With -e, each venue's own book is kept in the same pass too and priced as well.  Output lines then start with the name of
+// the book they come from: the venue's name, or its number counting from 1 if it wasn't given one, and "ALL" for the
+// consolidated book.
+
+#define MAX_VENUES     8                      // Most feeds that can be merged; a venue's number has to fit in the three bits below.
+#define VENUE_KEY_BITS FEED_KEY_SPARE_BITS    // Three bits no order ID of ASCII characters sets in its key.
+
+typedef struct {
+    Ring          ring;
+    pthread_t     thread;
+    char          *file_name;              // The feed's file, or NULL for a live feed,
+    char          *address;                // which is taken from this address.
+    Book          book;                    // The venue's own book, with -e.
+    unsigned long head, tail;              // The merge's place in the ring, and the ring's tail as of the last look.
+    unsigned long long time;               // The timestamp of the next message, while the venue is in the heap.
+    unsigned long long key_bits;           // The venue's number, spread over VENUE_KEY_BITS.
+    long          message_count, bytes_read, lines_dropped;  // For the statistics report.
+} Venue;
+Venue venues[MAX_VENUES];
+int   venue_count;                         // Set by -V.
+int   venue_books_wanted;                  // Set by -e.
+int   venue_heap[MAX_VENUES];              // Numbers of the venues with a message waiting, the one to go next on top.
+int   venue_heap_count;
+
+
+void add_venue(char *argument)  // Sets up a venue from a -V argument.
+{
+Venue *venue = &venues[venue_count];
+char *equals = strchr(argument,'=');
+//
+if (venue_count == MAX_VENUES || (equals && (equals == argument || equals - argument > FEED_ORDER_ID_MAX_LENGTH)))
+  {
+  fputs("No more than 8 venues (-V) can be merged, and a venue's name can be no more than 10 characters.\n",stderr);
+  exit(1);
+  }
+if (equals)
+  {
+  venue->book.symbol_length = equals - argument;
+  memcpy(venue->book.symbol,argument,venue->book.symbol_length);
+  argument = equals + 1;
+  }
+else
+  venue->book.symbol_length = sprintf(venue->book.symbol,"%d",venue_count + 1);
+if (!strncmp(argument,"socket:",7))
+  venue->address = argument + 7;
+else
+  venue->file_name = argument;
+venue->key_bits = ((unsigned long long)(venue_count & 1) << 39) | ((unsigned long long)(venue_count & 2) << 46) | ((unsigned long long)(venue_count & 4) << 53);
+venue_count++;
+}
+
+void *venue_thread(void *argument)  // Reads and parses one venue's feed, with input scanning state of its own.
+{
+Venue *venue = argument;
+//
+open_input(venue->file_name,venue->address);
+while (next_message())
+  {
+  message.timestamp_value = message_time(&message);  // The merge goes by this, so it's worked out here rather than on the main thread.
+  ring_put_message(&venue->ring,&venue->book,&message);
+  if (input_data == input_data_end)  // About to wait for more input?  Then don't leave the merge waiting on what has been read already.
+    ring_publish(&venue->ring);
+  }
+venue->bytes_read    = input_bytes_read;
+venue->lines_dropped = input_lines_dropped;
+ring_finish(&venue->ring);
+return(0);
+}
+
+void start_venues(void)
+{
+int i;
+if (venue_books_wanted)
+  book.symbol_length = sprintf(book.symbol,"ALL");
+for (i = 0; i < venue_count; i++)
+  {
+  if (venue_books_wanted)
+    initBook(&venues[i].book,&node_pool);
+  initRing(&venues[i].ring);
+  if (pthread_create(&venues[i].thread,0,venue_thread,&venues[i]))
+    {
+    fputs("Unable to start venue thread.\n",stderr);
+    exit(19);
+    }
+  }
+}
+
+void price_venue_batches(void)  // With -C, prices whatever batches the books are holding.
+{
+int i;
+if (book.pending_sides)
+  book_price_batch(&book,&output_writer);
+for (i = 0; i < venue_count; i++)
+  if (venues[i].book.pending_sides)
+    book_price_batch(&venues[i].book,&output_writer);
+}
+
+int venue_next(Venue *venue)  // Gets the venue's next message ready to be merged, waiting for its feed if need be; returns 0 once the feed has ended.
+{
+if (venue->head == venue->tail)
+  {
+  ring_release(&venue->ring,venue->head);
+  if (venue->address && __atomic_load_n(&venue->ring.tail,__ATOMIC_ACQUIRE) == venue->head)  // About to wait on a live feed?  Then write out what there is first.
+    {
+    price_venue_batches();
+    if (output_writer.flush_mode != FLUSH_AT_END)
+      output_flush(&output_writer);
+    }
+  if ((venue->tail = ring_wait_for_entries(&venue->ring,venue->head)) == venue->head)
+    return(0);
+  }
+venue->time = venue->ring.entries[venue->head & (RING_SIZE - 1)].message.timestamp_value;
+return(1);
+}
+
+int venue_before(int a,int b)  // Whether venue a's next message goes ahead of venue b's.
+{
+return(venues[a].time < venues[b].time || (venues[a].time == venues[b].time && a < b));
+}
+
+void venue_heap_down(int place)  // Moves the venue at a place in the heap down to where it belongs.
+{
+int child, venue = venue_heap[place];
+while ((child = 2 * place + 1) < venue_heap_count)
+  {
+  if (child + 1 < venue_heap_count && venue_before(venue_heap[child + 1],venue_heap[child]))
+    child++;
+  if (!venue_before(venue_heap[child],venue))
+    break;
+  venue_heap[place] = venue_heap[child];
+  place = child;
+  }
+venue_heap[place] = venue;
+}
+
+void merge_venues(void)  // Applies the venues' messages to the books in timestamp order, until every feed has ended.
+{
+Venue *venue;
+Message *merged;
+int i;
+//
+for (i = 0; i < venue_count; i++)
+  if (venue_next(&venues[i]))
+    venue_heap[venue_heap_count++] = i;
+for (i = venue_heap_count / 2 - 1; i >= 0; i--)
+  venue_heap_down(i);
+while (venue_heap_count)
+  {
+  venue  = &venues[venue_heap[0]];
+  merged = &venue->ring.entries[venue->head++ & (RING_SIZE - 1)].message;
+  merged->timestamp = merged->timestamp_text;
+  if (merged->order_key & VENUE_KEY_BITS)
+    fputs("Order id isn't ASCII; continuing.\n",stderr);
+  else
+    {
+    merged->order_key |= venue->key_bits;
+    message_count++;
+    venue->message_count++;
+    INSTRUMENT_MARK();
+    book_process_message(&book,merged,&output_writer);
+    if (venue_books_wanted)
+      book_process_message(&venue->book,merged,&output_writer);
+    }
+  if (!venue_next(venue))  // The feed has ended, so the venue leaves the heap.
+    venue_heap[0] = venue_heap[--venue_heap_count];
+  venue_heap_down(0);
+  }
+price_venue_batches();
+}
+
+void finish_venues(void)  // Waits for the venue threads, and adds up their figures for the statistics report.
+{
+int i;
+for (i = 0; i < venue_count; i++)
+  {
+  pthread_join(venues[i].thread,0);
+  input_bytes_read    += venues[i].bytes_read;
+  input_lines_dropped += venues[i].lines_dropped;
+  tally_book_memory(&venues[i].book);
+  if (statistics_wanted)
+    fprintf(stderr,"Venue %s: %ld messages, %ld bytes, %ld lines dropped\n",
+            venues[i].book.symbol,venues[i].message_count,venues[i].bytes_read,venues[i].lines_dropped);
+  }
+}
+
+
+/*---------- Batch replay subroutines ----------*/
+
+// With -B list, each file named in list, or each file in it if list is a directory (taken in name order), is a session of its
+// own, a trading day say, and is priced just as "./Pricer -f file" would price it, with a book of its own.  Sessions have
+// nothing to do with one another, so up to -j N of them (one per CPU unless told otherwise) are run at once, each in a child
+// process, which gives each one a fresh copy of all of the program's state for nothing.  The parent hands the sessions out
+// biggest file first, each to whichever child slot comes free next.  There is nothing to share out within a session, so this
+// one queue that every slot takes from balances the load as well as per-worker queues with stealing would, and no long day
+// started last holds up the end of the run.
+//
+// With -o dir, each session's output goes to dir/<input file name>.out.  Otherwise each child writes to a temporary file, and
+// the parent copies those to stdout in list order as they become available, so the stream is just what running the sessions
+// one after another would give.  The children leave their figures in a shared mapping, and the parent reports the totals on
+// stderr at the end, along with each session's figures under -s.
+
+typedef struct {
+    char  *file_name;
+    long  file_size;          // For handing out the biggest sessions first.
+    int   output_descriptor;  // Temporary file holding the session's output for the merged stream, or -1 with -o.
+    pid_t pid;                // The child running the session.
+    int   done, failed;
+    long  message_count, bytes_read, output_bytes, milliseconds;  // Filled in by the child.
+    long  peak_rss;           // KB, from wait4().
+} Session;
+Session *sessions;               // Kept in a shared mapping once the list is complete, so that the children can fill in their figures.
+int     session_count, job_count;
+char    *batch_list_name;        // Set by -B.
+char    *session_output_directory;  // Set by -o.
+
+
+void add_session(char *file_name)
+{
+struct stat file_status;
+if (!(session_count & (session_count + 1)) && (sessions = realloc(sessions,(session_count + 1) * 2 * sizeof(Session))) == 0)  // Doubling at 1, 3, 7, ...
+  {
+  fputs("insufficient memory for session list\n",stderr);
+  exit(22);
+  }
+memset(&sessions[session_count],0,sizeof(Session));
+sessions[session_count].file_name         = strdup(file_name);
+sessions[session_count].file_size         = stat(file_name,&file_status) ? 0 : file_status.st_size;  // A file that isn't there fails in its child, and is reported then.
+sessions[session_count].output_descriptor = -1;
+session_count++;
+}
+
+int compare_session_names(const void *a,const void *b)
+{
+return(strcmp(((Session *)a)->file_name,((Session *)b)->file_name));
+}
+
+void read_batch_list(char *list_name)  // Fills in the session list from a directory or a file of file names, one per line.
+{
+struct stat file_status;
+struct dirent *entry;
+char path[4096], *newline;
+DIR *directory;
+FILE *list;
+Session *shared;
+//
+if (stat(list_name,&file_status) == 0 && S_ISDIR(file_status.st_mode))
+  {
+  if ((directory = opendir(list_name)) == 0)
+    {
+    fputs("Unable to open batch directory.\n",stderr);
+    exit(22);
+    }
+  while ((entry = readdir(directory)))
+    {
+    snprintf(path,sizeof(path),"%s/%s",list_name,entry->d_name);
+    if (entry->d_name[0] != '.' && stat(path,&file_status) == 0 && S_ISREG(file_status.st_mode))  // Skip hidden files and anything that isn't a plain file.
+      add_session(path);
+    }
+  closedir(directory);
+  qsort(sessions,session_count,sizeof(Session),compare_session_names);
+  }
+else
+  {
+  if ((list = fopen(list_name,"r")) == 0)
+    {
+    fputs("Unable to open batch list.\n",stderr);
+    exit(22);
+    }
+  while (fgets(path,sizeof(path),list))
+    {
+    if ((newline = strchr(path,'\n')))
+      *newline = 0;
+    if (path[0])
+      add_session(path);
+    }
+  fclose(list);
+  }
+if (!session_count)
+  {
+  fputs("No sessions to replay.\n",stderr);
+  exit(22);
+  }
+if ((shared = mmap(0,session_count * sizeof(Session),PROT_READ | PROT_WRITE,MAP_SHARED | MAP_ANONYMOUS,-1,0)) == MAP_FAILED)
+  {
+  fputs("Unable to map session list.\n",stderr);
+  exit(22);
+  }
+memcpy(shared,sessions,session_count * sizeof(Session));
+free(sessions);
+sessions = shared;
+}
+
+void run_session(Session *session)  // Runs in the child: prices one session from start to finish, and leaves its figures behind.
+{
+struct timespec session_start, session_end;
+char path[4096], *base_name;
+int file_descriptor = session->output_descriptor;
+//
+if (session_output_directory)
+  {
+  base_name = strrchr(session->file_name,'/') ? strrchr(session->file_name,'/') + 1 : session->file_name;
+  snprintf(path,sizeof(path),"%s/%s.out",session_output_directory,base_name);
+  if ((file_descriptor = open(path,O_WRONLY | O_CREAT | O_TRUNC,0666)) < 0)
+    {
+    fputs("Unable to open session output file.\n",stderr);
+    exit(22);
+    }
+  }
+clock_gettime(CLOCK_MONOTONIC,&session_start);
+initBook(&book,&node_pool);
+open_input(session->file_name,0);
+initOutputWriter(&output_writer,file_descriptor,writer_thread_wanted);
+INSTRUMENT_START();
+while (next_message())
+  {
+  message_count++;
+  INSTRUMENT_STAGE(STAGE_PARSE);
+  book_process_message(&book,&message,&output_writer);
+  }
+if (book.pending_sides)
+  book_price_batch(&book,&output_writer);
+finish_output(&output_writer);
+INSTRUMENT_FINISH();
+clock_gettime(CLOCK_MONOTONIC,&session_end);
+session->message_count = message_count;
+session->bytes_read    = input_bytes_read;
+session->output_bytes  = output_writer.written;
+session->milliseconds  = (session_end.tv_sec - session_start.tv_sec) * 1000 + (session_end.tv_nsec - session_start.tv_nsec) / 1000000;
+exit(0);
+}
+
+void start_session(Session *session)
+{
+char path[4096];
+pid_t pid;
+snprintf(path,sizeof(path),"%s/PricerXXXXXX",getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+if (!session_output_directory)
+  {
+  if ((session->output_descriptor = mkstemp(path)) < 0)
+    {
+    fputs("Unable to create temporary output file.\n",stderr);
+    exit(22);
+    }
+  unlink(path);  // The descriptor is all anyone needs, and the file goes away by itself when it is closed.
+  }
+if ((pid = fork()) < 0)
+  {
+  fputs("Unable to start session process.\n",stderr);
+  exit(22);
+  }
+if (!pid)
+  run_session(session);
+session->pid = pid;  // Only the parent sets this, since the session is in shared memory.
+}
+
+void copy_session_output(Session *session)  // Appends a finished session's output to the merged stream on stdout.
+{
+char buffer[65536];
+long bytes;
+lseek(session->output_descriptor,0,SEEK_SET);
+while ((bytes = read(session->output_descriptor,buffer,sizeof(buffer))) > 0)
+  write_all(1,buffer,bytes);
+close(session->output_descriptor);
+}
+
+int compare_session_sizes(const void *a,const void *b)  // Sorts session numbers biggest file first, and in list order among equals.
+{
+long a_size = sessions[*(int *)a].file_size, b_size = sessions[*(int *)b].file_size;
+if (a_size != b_size)
+  return(a_size < b_size ? 1 : -1);
+return(*(int *)a - *(int *)b);
+}
+
+int run_batch(void)  // Runs every session in the list, and returns the exit status for the program.
+{
+int *order, started=0, running=0, copied=0, failed=0, status, i;
+long messages=0, bytes=0, session_milliseconds=0, longest=0, elapsed;
+struct rusage usage;
+pid_t pid;
+//
+read_batch_list(batch_list_name);
+if (!job_count)
+  job_count = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+if ((order = malloc(session_count * sizeof(int))) == 0)
+  {
+  fputs("insufficient memory for session list\n",stderr);
+  exit(22);
+  }
+for (i = 0; i < session_count; i++)
+  order[i] = i;
+qsort(order,session_count,sizeof(int),compare_session_sizes);
+clock_gettime(CLOCK_MONOTONIC,&start_time);
+while (copied < session_count)
+  {
+  for (; running < job_count && started < session_count; started++, running++)
+    start_session(&sessions[order[started]]);
+  if ((pid = wait4(-1,&status,0,&usage)) < 0)
+    {
+    if (errno == EINTR)
+      continue;
+    fputs("Lost track of the session processes.\n",stderr);
+    exit(22);
+    }
+  for (i = 0; i < session_count && sessions[i].pid != pid; i++)
+    ;
+  if (i == session_count)
+    continue;
+  running--;
+  sessions[i].done     = 1;
+  sessions[i].failed   = !WIFEXITED(status) || WEXITSTATUS(status);
+  sessions[i].peak_rss = usage.ru_maxrss;
+  if (sessions[i].failed)
+    {
+    fprintf(stderr,"Session %s failed; its output is incomplete.\n",sessions[i].file_name);
+    failed++;
+    }
+  for (; copied < session_count && sessions[copied].done; copied++)  // Pass on whatever is now complete at the front of the list.
+    if (!session_output_directory)
+      copy_session_output(&sessions[copied]);
+  }
+clock_gettime(CLOCK_MONOTONIC,&end_time);
+// The report: the totals, and how many sessions were running at a time on average, which is as many times as fast as running
+// them one at a time, provided there were that many cores free.  Integer arithmetic only, as elsewhere.
+if ((elapsed = (end_time.tv_sec - start_time.tv_sec) * 1000 + (end_time.tv_nsec - start_time.tv_nsec) / 1000000) < 1)
+  elapsed = 1;
+for (i = 0; i < session_count; i++)
+  {
+  messages             += sessions[i].message_count;
+  bytes                += sessions[i].bytes_read;
+  session_milliseconds += sessions[i].milliseconds;
+  if (sessions[i].milliseconds > longest)
+    longest = sessions[i].milliseconds;
+  if (statistics_wanted)
+    fprintf(stderr,"%s: %ld messages, %ld bytes in %ld ms: %ld messages/sec, %ld bytes of output, peak RSS %ld KB%s\n",
+            sessions[i].file_name,sessions[i].message_count,sessions[i].bytes_read,sessions[i].milliseconds,
+            sessions[i].message_count * 1000 / (sessions[i].milliseconds ? sessions[i].milliseconds : 1),
+            sessions[i].output_bytes,sessions[i].peak_rss,sessions[i].failed ? " (failed)" : "");
+  }
+fprintf(stderr,"%d sessions on %d jobs: %ld messages, %ld bytes in %ld ms: %ld messages/sec, %ld MB/s\n",
+        session_count,job_count < session_count ? job_count : session_count,messages,bytes,elapsed,messages * 1000 / elapsed,bytes / elapsed / 1000);
+fprintf(stderr,"Session time: %ld ms in all, %ld ms for the longest; %ld.%02ld sessions running at a time on average\n",
+        session_milliseconds,longest,session_milliseconds / elapsed,session_milliseconds * 100 / elapsed % 100);
+free(order);
+return(failed ? 23 : 0);
+}
+
+
+/*------------------------------ Main Program ------------------------------*/
+int main(int argc,char *argv[])
+{
+if (DEBUG)
+  fputs("DEBUG is on; expect volumninous output on the stdout channel.\n",stderr);
+
+
+/*---------- Parse command line argument(s) ----------*/
+// 1st argument is always program name; any options come next, then the target size(s).  The options are:
+//   -A N      Decode up to N messages ahead of the book and prefetch what they will need from it (see "Lookahead" under "Program-level subroutines").
+//   -b        The input is binary feed records (see FeedFormat.h) instead of text.
+//   -B list   Batch replay: price each file in the list or directory as a session of its own, several at once (see "Batch replay subroutines").
+//   -c file   Write a checkpoint to the named file every so often (see "Checkpoint subroutines").
+//   -C ms     Price once per batch of messages with the same timestamp (0), or in the same ms-millisecond interval (see message_bucket()).
+//   -e        With -V, also keep and price each venue's own book.
+//   -f file   Read the input from the named file (memory-mapped) instead of stdin.
+//   -F policy Flush output by size:N bytes, by time:MS milliseconds, or only at the end (see "Output writing subroutines").
+//   -H        Back the book node pool with huge pages.
+//   -i N      Take a checkpoint every N messages (default 1000000).
+//   -j N      Run up to N batch sessions at once (default one per CPU).
+//   -L addr   Live mode: take the feed from the first connection to a Unix-domain socket path or TCP [host:]port (see "Input scanning subroutines").
+//   -m N      Multi-symbol mode: each line has a symbol after the timestamp, and the books are kept by N worker threads (see "Multi-symbol subroutines").
+//   -o dir    Write each batch session's output to a file of its own in dir instead of all of it to stdout.
+//   -P        Pipelined mode: parse, work the book, and format output on three separate threads (see "Pipeline subroutines").
+//   -r file   Resume from the named checkpoint file, skipping the part of the input it covers.
+//   -R file   Write rolling statistics of the target prices to the named file (see "Rolling statistics subroutines").
+//   -s        Report statistics (throughput and the like) on stderr at the end of the run.
+//   -S file   Publish the book in a shared-memory snapshot in the named file (see "Snapshot publishing subroutines").
+//   -t ms     Write the rolling statistics as of every ms milliseconds of feed time (default 1000).
+//   -V feed   Merge this venue's feed, a file or socket:address, into a consolidated book; give once per venue (see "Venue subroutines").
+//   -w ms,... Keep rolling statistics over windows of these many milliseconds (default 60000).
+//   -W        Write output from a separate writer thread.
+while ((option = getopt(argc,argv,"A:bB:c:C:ef:F:Hi:j:L:m:o:Pr:R:sS:t:V:w:W")) != -1)
+  switch (option)
+    {
+    case 'A': lookahead_distance = atoi(optarg);  break;
+    case 'b': binary_input = 1;          break;
+    case 'B': batch_list_name = optarg;  break;
+    case 'c': checkpoint_file_name = optarg;  break;
+    case 'C': coalesce_interval = strtol(optarg,(char **)NULL,10);  break;
+    case 'e': venue_books_wanted = 1;    break;
+    case 'f': input_file_name = optarg;  break;
+    case 'F':
+      if (!strncmp(optarg,"size:",5))
+        {
+        output_writer.flush_mode  = FLUSH_BY_SIZE;
+        output_writer.flush_bytes = strtol(optarg+5,(char **)NULL,10);
+        }
+      else
+      if (!strncmp(optarg,"time:",5))
+        {
+        output_writer.flush_mode     = FLUSH_BY_TIME;
+        output_writer.flush_interval = strtol(optarg+5,(char **)NULL,10);
+        }
+      else
+      if (!strcmp(optarg,"end"))
+        output_writer.flush_mode = FLUSH_AT_END;
+      else
+        {
+        fputs(USAGE,stderr);
+        exit(1);
+        }
+      break;
+    case 'H': node_pool.huge_pages = 1;  break;
+    case 'i': checkpoint_interval = strtol(optarg,(char **)NULL,10);  break;
+    case 'j': job_count = atoi(optarg);  break;
+    case 'L': live_address = optarg;     break;
+    case 'm': worker_count = atoi(optarg);  break;
+    case 'o': session_output_directory = optarg;  break;
+    case 'P': pipeline_wanted = 1;       break;
+    case 'r': restart_file_name = optarg;  break;
+    case 'R': rolling_file_name = optarg;  break;
+    case 's': statistics_wanted = 1;     break;
+    case 'S': snapshot_file_name = optarg;  break;
+    case 't': rolling_interval = strtol(optarg,(char **)NULL,10);  break;
+    case 'V': add_venue(optarg);         break;
+    case 'w': set_rolling_windows(optarg);  break;
+    case 'W': writer_thread_wanted = 1;  break;
+    default:  fputs(USAGE,stderr);       exit(1);
+    }
+// Make sure that at least one target size has been supplied.  Several target sizes may be given, in which case all of them are
+// priced from the one book, and each output line is tagged with its target size in front, so that "grep '^200 ' | cut -d' ' -f2-"
+// on the output gives exactly what a run with the single target size 200 would have.
+if (optind == argc || argc - optind > MAX_TARGETS)
+  {
+  fputs(USAGE,stderr);
+  exit(1);
+  }
+for (target_count = 0; target_count < argc - optind; target_count++)
+  {
+  target_sizes[target_count] = strtol(argv[optind+target_count],(char **)NULL,10);  // Convert each passed argument to an integer.
+  if (!target_sizes[target_count])  // Rudimentary error handling, but sufficient for this purpose.
+    {
+    fputs("Invalid argument; must be a long integer.\n",stderr);
+    exit(2);
+    }
+  }
+if (worker_count < 0 || (worker_count && (binary_input || checkpoint_file_name || restart_file_name)))
+  {
+  fputs("Multi-symbol mode (-m) needs a positive number of workers, reads only text input, and can't be checkpointed.\n",stderr);
+  exit(1);
+  }
+if (pipeline_wanted && (worker_count || checkpoint_file_name))
+  {
+  fputs("Pipelined mode (-P) can't be combined with multi-symbol mode or with checkpoints.\n",stderr);
+  exit(1);
+  }
+if (batch_list_name ? job_count < 0 || input_file_name || live_address || worker_count || pipeline_wanted || checkpoint_file_name || restart_file_name
+                    : job_count || session_output_directory)
+  {
+  fputs("Batch mode (-B) takes its input files from the list, can't be combined with -m, -P or checkpoints, and is the only mode -j and -o go with.\n",stderr);
+  exit(1);
+  }
+if (coalesce_interval < -1 || (coalesce_interval >= 0 && worker_count))
+  {
+  fputs("Coalescing (-C) needs an interval of 0 or more milliseconds, and can't be combined with multi-symbol mode.\n",stderr);
+  exit(1);
+  }
+if (snapshot_file_name && (worker_count || batch_list_name))
+  {
+  fputs("Only a single book can be published (-S), so it can't be combined with -m or -B.\n",stderr);
+  exit(1);
+  }
+if (live_address && (input_file_name || restart_file_name))
+  {
+  fputs("Live mode (-L) takes its input from the socket, so it can't be combined with -f or resumed from a checkpoint.\n",stderr);
+  exit(1);
+  }
+if (lookahead_distance < 0 || lookahead_distance > LOOKAHEAD_MAX ||
+    (lookahead_distance && (worker_count || pipeline_wanted || venue_count || batch_list_name || checkpoint_file_name)))
+  {
+  fputs("Lookahead (-A) goes up to 256 messages, and works only on a single feed with no -P or checkpoints.\n",stderr);
+  exit(1);
+  }
+if (rolling_file_name ? rolling_interval <= 0 || worker_count || batch_list_name : rolling_window_count || rolling_interval != 1000)
+  {
+  fputs("Rolling statistics (-R) need an interval (-t) of 1 millisecond or more, can't be combined with -m or -B, and are the only thing -t and -w go with.\n",stderr);
+  exit(1);
+  }
+if (venue_count ? input_file_name || live_address || worker_count || pipeline_wanted || batch_list_name || checkpoint_file_name || restart_file_name
+                : venue_books_wanted)
+  {
+  fputs("Venue mode (-V) takes its input from the venues' feeds, can't be combined with -m, -P, -B or checkpoints, and is the only mode -e goes with.\n",stderr);
+  exit(1);
+  }
+if (batch_list_name)  // Batch mode does all of its work in child processes, one per session (see "Batch replay subroutines").
+  exit(run_batch());
+
+// Initialize the order table and price ladder data structures, which can't be done until the target sizes are known.
+if (!worker_count)
+  initBook(&book,&node_pool);
+
+if (restart_file_name)
+  resume_offset = load_checkpoint(restart_file_name);
+if (snapshot_file_name)
+  open_snapshot(snapshot_file_name,&book);
+if (rolling_file_name)
+  open_rolling(rolling_file_name,&book);
+if (checkpoint_interval < 1)
+  checkpoint_interval = 1;
+next_checkpoint_count = message_count + checkpoint_interval;
+
+/*-------------------- Main Loop --------------------*/
+if (!venue_count)  // With -V, each venue's thread opens its own feed.
+  {
+  open_input(input_file_name,live_address);
+  skip_input(resume_offset);
+  }
+clock_gettime(CLOCK_MONOTONIC,&start_time);
+if (venue_count)  // The venue threads read and parse the feeds, and this thread merges them and does the rest.
+  {
+  initOutputWriter(&output_writer,1,writer_thread_wanted);
+  start_venues();
+  INSTRUMENT_START();
+  merge_venues();
+  finish_venues();
+  }
+else
+if (pipeline_wanted)  // The main thread just parses here too, and the book and format threads do the rest.
+  {
+  initOutputWriter(&output_writer,1,writer_thread_wanted);
+  start_pipeline();
+  while (next_message())
+    {
+    message_count++;
+    pipeline_message();
+    }
+  finish_pipeline();
+  }
+else
+if (!worker_count)
+  {
+  initOutputWriter(&output_writer,1,writer_thread_wanted);
+  INSTRUMENT_START();
+  while ((current_message = lookahead_distance ? next_lookahead_message() : next_message() ? &message : 0))  // Accept input from the file or stdin, one message at a time.
+    {
+    message_count++;
+    INSTRUMENT_STAGE(STAGE_PARSE);
+
+    book_process_message(&book,current_message,&output_writer);
+
+    if (checkpoint_file_name && message_count >= next_checkpoint_count)
+      {
+      if (book.pending_sides)  // The checkpoint has to cover everything printed so far, so the batch is cut short here.
+        book_price_batch(&book,&output_writer);
+      take_checkpoint();
+      next_checkpoint_count = message_count + checkpoint_interval;
+      }
+    if (live_address && input_data == input_data_end && lookahead_head == lookahead_tail)  // Price and write out what there is before the feed is read again, which may mean waiting for it.
+      {
+      if (book.pending_sides)
+        book_price_batch(&book,&output_writer);
+      if (output_writer.flush_mode != FLUSH_AT_END)
+        output_flush(&output_writer);
+      }
+    }
+  if (book.pending_sides)
+    book_price_batch(&book,&output_writer);
+  }
+else  // In multi-symbol mode, all this thread does is parse the input and pass it on to the workers.
+  {
+  start_workers();
+  while (next_message())
+    {
+    message_count++;
+    dispatch_message();
+    if (input_data == input_data_end)  // As in pipelined mode, publish everything before waiting for input.
+      for (temp_counter = 0; temp_counter < worker_count; temp_counter++)
+        ring_publish(&workers[temp_counter].ring);
+    }
+  finish_workers();
+  }
+
+if (book.rolling)
+  finish_rolling(book.rolling);
+finish_output(&output_writer);
+INSTRUMENT_FINISH();
+if (statistics_wanted)  // Integer arithmetic only here too; bytes per millisecond over 1000 is MB/s.
+  {
+  clock_gettime(CLOCK_MONOTONIC,&end_time);
+  temp_long = (end_time.tv_sec - start_time.tv_sec) * 1000 + (end_time.tv_nsec - start_time.tv_nsec) / 1000000;
+  if (!temp_long)
+    temp_long = 1;
+  fprintf(stderr,"%ld messages, %ld bytes in %ld ms: %ld messages/sec, %ld MB/s\n",
+          message_count,input_bytes_read,temp_long,message_count * 1000 / temp_long,input_bytes_read / temp_long / 1000);
+  fprintf(stderr,"Book nodes: %ld live, %ld peak, %ld chunk(s) of %ld KB\n",
+          node_pool.live_count,node_pool.peak_count,node_pool.chunk_count,NODE_POOL_CHUNK_SIZE / 1024);
+  // The memory report: what each live order and level costs, and what the whole run peaked at.  Order records are allocated a
+  // block at a time, and each live order also takes up two to four order table slots.
+  if (!worker_count)
+    {
+    tally_book_memory(&book);
+    tally_pool_memory(&node_pool);
+    }
+  getrusage(RUSAGE_SELF,&resource_usage);
+  fprintf(stderr,"Orders: %ld live, %ld peak; %ld bytes per record (%ld KB of records allocated), %ld bytes of order table per live order\n",
+          node_pool.order_live_count,node_pool.order_peak_count,(long)sizeof(Order),
+          memory_record_bytes / 1024,
+          node_pool.order_live_count ? memory_table_bytes / node_pool.order_live_count : 0);
+  fprintf(stderr,"Levels: %ld in ladder windows at %ld bytes apiece (%ld KB of window per book), %ld in overflow lists (the book nodes above)\n",
+          memory_window_levels,(long)sizeof(Level),2 * LADDER_TICKS * (long)sizeof(Level) / 1024,node_pool.live_count);
+  fprintf(stderr,"Peak RSS: %ld KB\n",resource_usage.ru_maxrss);
+  if (live_address)
+    live_report();
+  }
+release_node_pool(&node_pool);
 exit(0);
 }
 
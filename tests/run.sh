@@ -0,0 +1,27 @@
+#!/bin/sh
+# Runs Pricer on each feed here and compares what it prints with what the original program printed for the same feed, which is
+# kept in <feed>.<target size>.out.  Each feed is also run through FeedConvert and read back with -b, unless it has lines that
+# can't be converted to binary records.  From the top directory:
+#   tests/run.sh [pricer [feedconvert]]
+pricer=${1:-./Pricer}
+feedconvert=${2:-./FeedConvert}
+binary=/tmp/pricer-test.$$
+failures=0
+for expected in tests/*.out
+do
+  name=${expected%.*}
+  target=${name##*.}
+  feed=${name%.*}.txt
+  formats="text -A -b"
+  "$feedconvert" -b < "$feed" 2>&1 > $binary | grep -qv "records converted" && formats="text -A"
+  for options in $formats
+  do
+    case $options in
+      text) "$pricer" "$target" < "$feed" ;;
+      -A)   "$pricer" -A 8 "$target" < "$feed" ;;
+      -b)   "$pricer" -b "$target" < $binary ;;
+    esac 2>/dev/null | cmp -s - "$expected" || { echo "FAILED: $feed, target $target, $options"; failures=$((failures + 1)); }
+  done
+done
+rm -f $binary
+[ $failures = 0 ] && echo "All tests passed." || exit 1